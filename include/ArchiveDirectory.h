@@ -0,0 +1,188 @@
+#pragma once
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <optional>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "CRC32.h"
+#include "MappedFile.h"
+
+//The central directory is appended after the last member so that readers can find any member without
+//walking the headers. Layout, all numbers little endian:
+//  entries      DIRECTORY_ENTRY_SIZE bytes per member, in archive order
+//  hash table   bucketCount 32 bit slots holding entry index + 1, 0 when empty, linear probing
+//  names        the member names back to back, referenced from the entries
+//  trailer      DIRECTORY_TRAILER_SIZE bytes at the very end of the file, pointing back at the entries
+//The trailer carries a CRC of the directory, so an archive written before the directory existed, whose
+//last bytes are member data, is not mistaken for one with a directory.
+#define DIRECTORY_MAGIC "QAD3"
+#define DIRECTORY_ENTRY_SIZE 64
+#define DIRECTORY_TRAILER_SIZE 32
+
+struct DirectoryEntry {
+	std::string name;
+	std::uint64_t headerOffset{}; //where the member's own header starts
+	std::uint64_t dataOffset{}; //where its compressed data starts
+	std::uint64_t originalSize{};
+	std::uint64_t compressedSize{};
+	std::uint32_t originalCRC{};
+	std::uint32_t dictionaryID{};
+	char compressionMethod{};
+	std::int64_t modified{}; //last write time of the file added, in ticks of the file clock, 0 when not known
+	std::uint64_t contentHash{}; //of the expanded data, the low half of a ContentHasher fingerprint, known when modified is
+};
+
+//FNV-1a, the hash the directory is indexed by
+std::uint32_t hashMemberName(std::string_view name) {
+	std::uint32_t hash = 2166136261u;
+	for (unsigned char c : name)
+		hash = (hash ^ c) * 16777619u;
+	return hash;
+}
+
+void storeLittleEndian(unsigned char* buffer, std::uint64_t number, int numberOfBytes) {
+	while (numberOfBytes-- > 0) {
+		*buffer++ = static_cast<unsigned char>(number & 0xff);
+		number >>= 8;
+	}
+}
+
+std::uint64_t loadLittleEndian(const unsigned char* buffer, int numberOfBytes) {
+	std::uint64_t number{ 0 };
+	while (numberOfBytes-- > 0)
+		number = (number << 8) | buffer[numberOfBytes];
+	return number;
+}
+
+//appends the directory for entries and its trailer at the current position of output
+void writeArchiveDirectory(std::ostream& output, std::vector<DirectoryEntry> const& entries) {
+	std::uint64_t directoryOffset = output.tellp();
+	std::uint32_t bucketCount{ 1 };
+	while (bucketCount < entries.size() * 2)
+		bucketCount <<= 1;
+	std::vector<unsigned char> directory(entries.size() * DIRECTORY_ENTRY_SIZE + bucketCount * 4);
+	std::string names;
+	for (std::size_t i = 0; i < entries.size(); ++i) {
+		auto& entry = entries[i];
+		unsigned char* record = directory.data() + i * DIRECTORY_ENTRY_SIZE;
+		storeLittleEndian(record + 0, entry.headerOffset, 8);
+		storeLittleEndian(record + 8, entry.dataOffset, 8);
+		storeLittleEndian(record + 16, entry.originalSize, 8);
+		storeLittleEndian(record + 24, entry.compressedSize, 8);
+		storeLittleEndian(record + 32, entry.originalCRC, 4);
+		storeLittleEndian(record + 36, entry.dictionaryID, 4);
+		storeLittleEndian(record + 40, names.size(), 4);
+		storeLittleEndian(record + 44, entry.name.size(), 2);
+		record[46] = static_cast<unsigned char>(entry.compressionMethod);
+		record[47] = 0; //reserved
+		storeLittleEndian(record + 48, static_cast<std::uint64_t>(entry.modified), 8);
+		storeLittleEndian(record + 56, entry.contentHash, 8);
+		names += entry.name;
+		unsigned char* table = directory.data() + entries.size() * DIRECTORY_ENTRY_SIZE;
+		std::uint32_t slot = hashMemberName(entry.name) & (bucketCount - 1);
+		while (loadLittleEndian(table + slot * 4, 4) != 0)
+			slot = (slot + 1) & (bucketCount - 1);
+		storeLittleEndian(table + slot * 4, i + 1, 4);
+	}
+	directory.insert(std::end(directory), std::begin(names), std::end(names));
+	unsigned char trailer[DIRECTORY_TRAILER_SIZE]{};
+	std::memcpy(trailer, DIRECTORY_MAGIC, 4);
+	storeLittleEndian(trailer + 4, entries.size(), 4);
+	storeLittleEndian(trailer + 8, directoryOffset, 8);
+	storeLittleEndian(trailer + 16, directory.size(), 8);
+	storeLittleEndian(trailer + 24, bucketCount, 4);
+	storeLittleEndian(trailer + 28, calculateBlockCRC32(directory.size(), CRC_MASK, directory.data()) ^ CRC_MASK, 4);
+	output.write(reinterpret_cast<const char*>(directory.data()), directory.size());
+	output.write(reinterpret_cast<const char*>(trailer), DIRECTORY_TRAILER_SIZE);
+}
+
+
+//Read side of the directory. The archive is mapped read only, and entries are decoded from the mapping
+//on demand, so finding one member among many costs a hash probe rather than a scan of the archive.
+class ArchiveDirectory {
+public:
+	//nullptr when the archive has no directory, the caller then falls back to walking the headers
+	static std::unique_ptr<ArchiveDirectory> open(std::string const& path) {
+		auto file = std::make_unique<MappedFile>(path, MappedFile::Access::ReadOnly);
+		if (file->size() < DIRECTORY_TRAILER_SIZE)
+			return nullptr;
+		auto trailer = reinterpret_cast<const unsigned char*>(file->data() + file->size() - DIRECTORY_TRAILER_SIZE);
+		if (std::memcmp(trailer, DIRECTORY_MAGIC, 4) != 0)
+			return nullptr;
+		std::uint32_t count = static_cast<std::uint32_t>(loadLittleEndian(trailer + 4, 4));
+		std::uint64_t offset = loadLittleEndian(trailer + 8, 8);
+		std::uint64_t size = loadLittleEndian(trailer + 16, 8);
+		std::uint32_t bucketCount = static_cast<std::uint32_t>(loadLittleEndian(trailer + 24, 4));
+		std::uint64_t available = file->size() - DIRECTORY_TRAILER_SIZE;
+		if (offset > available || size != available - offset || bucketCount == 0 || (bucketCount & (bucketCount - 1)) != 0
+			|| static_cast<std::uint64_t>(count) * DIRECTORY_ENTRY_SIZE + bucketCount * 4ull > size)
+			return nullptr;
+		auto directory = reinterpret_cast<const unsigned char*>(file->data() + offset);
+		if ((calculateBlockCRC32(size, CRC_MASK, directory) ^ CRC_MASK) != loadLittleEndian(trailer + 28, 4))
+			return nullptr;
+		return std::unique_ptr<ArchiveDirectory>{ new ArchiveDirectory{ std::move(file), offset, size, count, bucketCount } };
+	}
+
+	std::uint32_t size() const {
+		return count;
+	}
+	//where the member data ends and the directory begins
+	std::uint64_t offset() const {
+		return directoryOffset;
+	}
+	DirectoryEntry entry(std::uint32_t index) const {
+		const unsigned char* record = entries + static_cast<std::uint64_t>(index) * DIRECTORY_ENTRY_SIZE;
+		DirectoryEntry entry;
+		entry.headerOffset = loadLittleEndian(record + 0, 8);
+		entry.dataOffset = loadLittleEndian(record + 8, 8);
+		entry.originalSize = loadLittleEndian(record + 16, 8);
+		entry.compressedSize = loadLittleEndian(record + 24, 8);
+		entry.originalCRC = static_cast<std::uint32_t>(loadLittleEndian(record + 32, 4));
+		entry.dictionaryID = static_cast<std::uint32_t>(loadLittleEndian(record + 36, 4));
+		entry.compressionMethod = static_cast<char>(record[46]);
+		entry.modified = static_cast<std::int64_t>(loadLittleEndian(record + 48, 8));
+		entry.contentHash = loadLittleEndian(record + 56, 8);
+		entry.name = name(record);
+		return entry;
+	}
+	std::optional<DirectoryEntry> find(std::string_view memberName) const {
+		std::uint32_t slot = hashMemberName(memberName) & (bucketCount - 1);
+		for (std::uint32_t probes = 0; probes < bucketCount; ++probes) {
+			std::uint32_t index = static_cast<std::uint32_t>(loadLittleEndian(table + slot * 4, 4));
+			if (index == 0 || index > count)
+				return std::nullopt;
+			if (name(entries + static_cast<std::uint64_t>(index - 1) * DIRECTORY_ENTRY_SIZE) == memberName)
+				return entry(index - 1);
+			slot = (slot + 1) & (bucketCount - 1);
+		}
+		return std::nullopt;
+	}
+
+private:
+	ArchiveDirectory(std::unique_ptr<MappedFile> file, std::uint64_t offset, std::uint64_t size, std::uint32_t count, std::uint32_t bucketCount)
+		: file{ std::move(file) }, directoryOffset{ offset }, count{ count }, bucketCount{ bucketCount } {
+		entries = reinterpret_cast<const unsigned char*>(this->file->data() + offset);
+		table = entries + static_cast<std::uint64_t>(count) * DIRECTORY_ENTRY_SIZE;
+		names = reinterpret_cast<const char*>(table + bucketCount * 4ull);
+		namesSize = size - (names - reinterpret_cast<const char*>(entries));
+	}
+	std::string_view name(const unsigned char* record) const {
+		std::uint64_t nameOffset = loadLittleEndian(record + 40, 4);
+		std::uint64_t nameLength = loadLittleEndian(record + 44, 2);
+		if (nameOffset > namesSize || nameLength > namesSize - nameOffset)
+			return {};
+		return { names + nameOffset, static_cast<std::size_t>(nameLength) };
+	}
+
+	std::unique_ptr<MappedFile> file;
+	std::uint64_t directoryOffset;
+	std::uint32_t count;
+	std::uint32_t bucketCount;
+	const unsigned char* entries{ nullptr };
+	const unsigned char* table{ nullptr };
+	const char* names{ nullptr };
+	std::uint64_t namesSize{ 0 };
+};
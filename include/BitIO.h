@@ -10,6 +10,7 @@
 namespace stl {
 	struct BitFile {
 		std::fstream file{};
+		std::iostream* stream{ &file }; //file, unless the BitFile was attached to a stream that is already open
 		std::uint32_t rack{ 0 };
 		std::uint32_t mask{ 0 };
 	};
@@ -39,26 +40,37 @@ namespace stl {
 		bitFile->mask = 0x80;
 		return bitFile;
 	}
+	//codes into or out of a stream owned by the caller, such as the archive being written
+	std::unique_ptr<BitFile> attachBitFile(std::iostream& stream) {
+		auto bitFile = std::make_unique<BitFile>();
+		bitFile->stream = &stream;
+		bitFile->rack = 0;
+		bitFile->mask = 0x80;
+		return bitFile;
+	}
+	//pads the last byte, an attached stream is left open at the end of the coded data
 	void closeOutputBitFile(std::unique_ptr<BitFile>& bitFile) {
 		if (bitFile->mask != 0x80) {
-			if (!bitFile->file.put(bitFile->rack)) {
+			if (!bitFile->stream->put(bitFile->rack)) {
 				fatalError("An error occurred in closeOutputBitFile\n");
 			}
+			bitFile->rack = 0;
+			bitFile->mask = 0x80;
 		}
-		bitFile->file.close();
+		if (bitFile->stream == &bitFile->file)
+			bitFile->file.close();
 	}
 	void closeInputBitFile(std::unique_ptr<BitFile>& bitFile) {
-		bitFile->file.close();
+		if (bitFile->stream == &bitFile->file)
+			bitFile->file.close();
 	}
 
 	void outputBit(std::unique_ptr<BitFile>& bitFile, int bit = 0) {
-		static int counter = 0;
 		if (bit)
 			bitFile->rack |= bitFile->mask;
 		bitFile->mask >>= 1;
 		if (bitFile->mask == 0) {
-			++counter;
-			if (!bitFile->file.put(bitFile->rack)) {
+			if (!bitFile->stream->put(bitFile->rack)) {
 				fatalError("ERROR: An error occurred in outputBits\n");
 			}
 			bitFile->rack = 0;
@@ -74,7 +86,7 @@ namespace stl {
 				bitFile->rack |= bitFile->mask;
 			bitFile->mask >>= 1;
 			if (bitFile->mask == 0) {
-				if (!bitFile->file.put(bitFile->rack)) {
+				if (!bitFile->stream->put(bitFile->rack)) {
 					fatalError("An error occurred in outputBits\n");
 				}
 				bitFile->rack = 0;
@@ -83,11 +95,22 @@ namespace stl {
 			mask >>= 1;
 		}
 	}
+	//byte oriented coders write whole bytes, the rack must be empty (mask == 0x80) when they are used
+	void outputByte(std::unique_ptr<BitFile>& bitFile, std::uint8_t byte) {
+		if (!bitFile->stream->put(byte)) {
+			fatalError("An error occurred in outputByte\n");
+		}
+	}
+	int inputByte(std::unique_ptr<BitFile>& bitFile) {
+		int c = bitFile->stream->get();
+		return (c == EOF) ? 0 : c;
+	}
+
 	int inputBit(std::unique_ptr<BitFile>& bitFile) {
 		int value{};
 		char ch{};
 		if (bitFile->mask == 0x80) {
-			bitFile->file.get(ch);
+			bitFile->stream->get(ch);
 			bitFile->rack = ch;
 		}
 		value = bitFile->rack & bitFile->mask;
@@ -102,9 +125,9 @@ namespace stl {
 		mask = 1L << (bitCount - 1);
 		while (mask != 0) {
 			if (bitFile->mask == 0x80) {
-				bitFile->file.get(ch);
-				if (bitFile->file.eof())
-					fatalError("An error occurred in inputBits\n");
+				bitFile->stream->get(ch);
+				if (bitFile->stream->eof())
+					throw FileError("Unexpected end of coded data\n");
 				bitFile->rack = ch;
 			}
 			if (bitFile->rack & bitFile->mask)
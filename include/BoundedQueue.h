@@ -0,0 +1,50 @@
+#pragma once
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <mutex>
+
+//Hands items from one stage of a pipeline to the next, in order. push waits while capacity items are
+//queued, which keeps a fast stage from running away from a slow one, and pop waits while none are.
+//Closing the queue releases both, so a pipeline can be taken down from any stage.
+template <typename T>
+class BoundedQueue {
+public:
+	explicit BoundedQueue(std::size_t capacity) : capacity{ capacity } {}
+
+	//the item is dropped once the queue is closed
+	void push(T item) {
+		std::unique_lock lock{ mutex };
+		changed.wait(lock, [this] { return items.size() < capacity || closed; });
+		if (closed)
+			return;
+		items.push_back(std::move(item));
+		changed.notify_all();
+	}
+
+	//false once the queue is closed and empty
+	bool pop(T& item) {
+		std::unique_lock lock{ mutex };
+		changed.wait(lock, [this] { return !items.empty() || closed; });
+		if (items.empty())
+			return false;
+		item = std::move(items.front());
+		items.pop_front();
+		changed.notify_all();
+		return true;
+	}
+
+	//nothing more will be pushed
+	void close() {
+		std::lock_guard lock{ mutex };
+		closed = true;
+		changed.notify_all();
+	}
+
+private:
+	std::size_t capacity;
+	std::deque<T> items;
+	bool closed{ false };
+	std::mutex mutex;
+	std::condition_variable changed;
+};
@@ -0,0 +1,262 @@
+#pragma once
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <streambuf>
+#include <vector>
+#if defined (_MSC_VER)
+#include <intrin.h>
+#endif
+#if defined (__x86_64__) || defined (_M_X64)
+#include <immintrin.h>
+#define CRC32_CLMUL
+#endif
+
+#define CRC_MASK 0xFFFFFFFFL
+#define CRC32_POLYNOMIAL 0xEDB88320L //CRC-32 Adler
+
+//All the block functions work on the running CRC register: start with CRC_MASK, feed the blocks in order
+//and xor the result with CRC_MASK once at the end. That yields the standard reflected CRC-32.
+
+constexpr std::uint32_t ccitt32Table[256] = { 0x00000000,0x77073096,0xee0e612c,0x990951ba,0x076dc419,0x706af48f,0xe963a535,0x9e6495a3,
+		0x0edb8832,0x79dcb8a4,0xe0d5e91e,0x97d2d988,0x09b64c2b,0x7eb17cbd,0xe7b82d07,0x90bf1d91,
+		0x1db71064,0x6ab020f2,0xf3b97148,0x84be41de,0x1adad47d,0x6ddde4eb,0xf4d4b551,0x83d385c7,
+		0x136c9856,0x646ba8c0,0xfd62f97a,0x8a65c9ec,0x14015c4f,0x63066cd9,0xfa0f3d63,0x8d080df5,
+		0x3b6e20c8,0x4c69105e,0xd56041e4,0xa2677172,0x3c03e4d1,0x4b04d447,0xd20d85fd,0xa50ab56b,
+		0x35b5a8fa,0x42b2986c,0xdbbbc9d6,0xacbcf940,0x32d86ce3,0x45df5c75,0xdcd60dcf,0xabd13d59,
+		0x26d930ac,0x51de003a,0xc8d75180,0xbfd06116,0x21b4f4b5,0x56b3c423,0xcfba9599,0xb8bda50f,
+		0x2802b89e,0x5f058808,0xc60cd9b2,0xb10be924,0x2f6f7c87,0x58684c11,0xc1611dab,0xb6662d3d,
+		0x76dc4190,0x01db7106,0x98d220bc,0xefd5102a,0x71b18589,0x06b6b51f,0x9fbfe4a5,0xe8b8d433,
+		0x7807c9a2,0x0f00f934,0x9609a88e,0xe10e9818,0x7f6a0dbb,0x086d3d2d,0x91646c97,0xe6635c01,
+		0x6b6b51f4,0x1c6c6162,0x856530d8,0xf262004e,0x6c0695ed,0x1b01a57b,0x8208f4c1,0xf50fc457,
+		0x65b0d9c6,0x12b7e950,0x8bbeb8ea,0xfcb9887c,0x62dd1ddf,0x15da2d49,0x8cd37cf3,0xfbd44c65,
+		0x4db26158,0x3ab551ce,0xa3bc0074,0xd4bb30e2,0x4adfa541,0x3dd895d7,0xa4d1c46d,0xd3d6f4fb,
+		0x4369e96a,0x346ed9fc,0xad678846,0xda60b8d0,0x44042d73,0x33031de5,0xaa0a4c5f,0xdd0d7cc9,
+		0x5005713c,0x270241aa,0xbe0b1010,0xc90c2086,0x5768b525,0x206f85b3,0xb966d409,0xce61e49f,
+		0x5edef90e,0x29d9c998,0xb0d09822,0xc7d7a8b4,0x59b33d17,0x2eb40d81,0xb7bd5c3b,0xc0ba6cad,
+		0xedb88320,0x9abfb3b6,0x03b6e20c,0x74b1d29a,0xead54739,0x9dd277af,0x04db2615,0x73dc1683,
+		0xe3630b12,0x94643b84,0x0d6d6a3e,0x7a6a5aa8,0xe40ecf0b,0x9309ff9d,0x0a00ae27,0x7d079eb1,
+		0xf00f9344,0x8708a3d2,0x1e01f268,0x6906c2fe,0xf762575d,0x806567cb,0x196c3671,0x6e6b06e7,
+		0xfed41b76,0x89d32be0,0x10da7a5a,0x67dd4acc,0xf9b9df6f,0x8ebeeff9,0x17b7be43,0x60b08ed5,
+		0xd6d6a3e8,0xa1d1937e,0x38d8c2c4,0x4fdff252,0xd1bb67f1,0xa6bc5767,0x3fb506dd,0x48b2364b,
+		0xd80d2bda,0xaf0a1b4c,0x36034af6,0x41047a60,0xdf60efc3,0xa867df55,0x316e8eef,0x4669be79,
+		0xcb61b38c,0xbc66831a,0x256fd2a0,0x5268e236,0xcc0c7795,0xbb0b4703,0x220216b9,0x5505262f,
+		0xc5ba3bbe,0xb2bd0b28,0x2bb45a92,0x5cb36a04,0xc2d7ffa7,0xb5d0cf31,0x2cd99e8b,0x5bdeae1d,
+		0x9b64c2b0,0xec63f226,0x756aa39c,0x026d930a,0x9c0906a9,0xeb0e363f,0x72076785,0x05005713,
+		0x95bf4a82,0xe2b87a14,0x7bb12bae,0x0cb61b38,0x92d28e9b,0xe5d5be0d,0x7cdcefb7,0x0bdbdf21,
+		0x86d3d2d4,0xf1d4e242,0x68ddb3f8,0x1fda836e,0x81be16cd,0xf6b9265b,0x6fb077e1,0x18b74777,
+		0x88085ae6,0xff0f6a70,0x66063bca,0x11010b5c,0x8f659eff,0xf862ae69,0x616bffd3,0x166ccf45,
+		0xa00ae278,0xd70dd2ee,0x4e048354,0x3903b3c2,0xa7672661,0xd06016f7,0x4969474d,0x3e6e77db,
+		0xaed16a4a,0xd9d65adc,0x40df0b66,0x37d83bf0,0xa9bcae53,0xdebb9ec5,0x47b2cf7f,0x30b5ffe9,
+		0xbdbdf21c,0xcabac28a,0x53b39330,0x24b4a3a6,0xbad03605,0xcdd70693,0x54de5729,0x23d967bf,
+		0xb3667a2e,0xc4614ab8,0x5d681b02,0x2a6f2b94,0xb40bbe37,0xc30c8ea1,0x5a05df1b,0x2d02ef8d
+};
+
+//crcSlicingTables[k][b] is the CRC of byte b followed by k zero bytes. That lets slicing-by-8 and
+//slicing-by-16 fold 8 or 16 input bytes into the register with independent table lookups.
+constexpr std::array<std::array<std::uint32_t, 256>, 16> makeSlicingTables() {
+	std::array<std::array<std::uint32_t, 256>, 16> tables{};
+	for (int i = 0; i < 256; ++i)
+		tables[0][i] = ccitt32Table[i];
+	for (int k = 1; k < 16; ++k) {
+		for (int i = 0; i < 256; ++i)
+			tables[k][i] = (tables[k - 1][i] >> 8) ^ ccitt32Table[tables[k - 1][i] & 0xff];
+	}
+	return tables;
+}
+
+constexpr auto crcSlicingTables = makeSlicingTables();
+
+std::uint32_t loadLittleEndian32(const unsigned char* ptr) {
+	return std::uint32_t(ptr[0]) | std::uint32_t(ptr[1]) << 8 | std::uint32_t(ptr[2]) << 16 | std::uint32_t(ptr[3]) << 24;
+}
+
+std::uint32_t calculateBlockCRC32Bytewise(std::size_t count, std::uint32_t crc, const unsigned char* ptr) {
+	while (count-- != 0)
+		crc = (crc >> 8) ^ ccitt32Table[(crc ^ *ptr++) & 0xff];
+	return crc;
+}
+
+std::uint32_t calculateBlockCRC32Slicing(std::size_t count, std::uint32_t crc, const unsigned char* ptr) {
+	auto& t = crcSlicingTables;
+	for (; count >= 16; count -= 16, ptr += 16) {
+		std::uint32_t word0 = loadLittleEndian32(ptr) ^ crc;
+		std::uint32_t word1 = loadLittleEndian32(ptr + 4);
+		std::uint32_t word2 = loadLittleEndian32(ptr + 8);
+		std::uint32_t word3 = loadLittleEndian32(ptr + 12);
+		crc = t[15][word0 & 0xff] ^ t[14][(word0 >> 8) & 0xff] ^ t[13][(word0 >> 16) & 0xff] ^ t[12][word0 >> 24]
+			^ t[11][word1 & 0xff] ^ t[10][(word1 >> 8) & 0xff] ^ t[9][(word1 >> 16) & 0xff] ^ t[8][word1 >> 24]
+			^ t[7][word2 & 0xff] ^ t[6][(word2 >> 8) & 0xff] ^ t[5][(word2 >> 16) & 0xff] ^ t[4][word2 >> 24]
+			^ t[3][word3 & 0xff] ^ t[2][(word3 >> 8) & 0xff] ^ t[1][(word3 >> 16) & 0xff] ^ t[0][word3 >> 24];
+	}
+	if (count >= 8) {
+		std::uint32_t word0 = loadLittleEndian32(ptr) ^ crc;
+		std::uint32_t word1 = loadLittleEndian32(ptr + 4);
+		crc = t[7][word0 & 0xff] ^ t[6][(word0 >> 8) & 0xff] ^ t[5][(word0 >> 16) & 0xff] ^ t[4][word0 >> 24]
+			^ t[3][word1 & 0xff] ^ t[2][(word1 >> 8) & 0xff] ^ t[1][(word1 >> 16) & 0xff] ^ t[0][word1 >> 24];
+		count -= 8;
+		ptr += 8;
+	}
+	return calculateBlockCRC32Bytewise(count, crc, ptr);
+}
+
+#if defined (CRC32_CLMUL)
+#if defined (__GNUC__)
+#define CRC32_CLMUL_TARGET __attribute__((target("pclmul,sse4.1")))
+#else
+#define CRC32_CLMUL_TARGET
+#endif
+
+//multiplies both halves of x by their fold constant in k and adds the next 16 bytes of data
+CRC32_CLMUL_TARGET inline __m128i foldCRC32(__m128i x, __m128i k, __m128i data) {
+	return _mm_xor_si128(_mm_xor_si128(_mm_clmulepi64_si128(x, k, 0x11), _mm_clmulepi64_si128(x, k, 0x00)), data);
+}
+
+//Folds the data 64 bytes at a time with carry-less multiplies and reduces the remainder with a Barrett
+//reduction, following Intel's "Fast CRC Computation for Generic Polynomials Using PCLMULQDQ".
+//The constants are x^n mod P for the fold distances of the reflected polynomial.
+//count must be at least 64 and a multiple of 16.
+CRC32_CLMUL_TARGET std::uint32_t calculateBlockCRC32Clmul(std::size_t count, std::uint32_t crc, const unsigned char* ptr) {
+	alignas(16) static const std::uint64_t k1k2[] = { 0x0154442bd4, 0x01c6e41596 };
+	alignas(16) static const std::uint64_t k3k4[] = { 0x01751997d0, 0x00ccaa009e };
+	alignas(16) static const std::uint64_t k5k0[] = { 0x0163cd6124, 0x0000000000 };
+	alignas(16) static const std::uint64_t poly[] = { 0x01db710641, 0x01f7011641 };
+	auto load = [](const unsigned char* p) { return _mm_loadu_si128(reinterpret_cast<const __m128i*>(p)); };
+
+	__m128i x1 = _mm_xor_si128(load(ptr), _mm_cvtsi32_si128(static_cast<int>(crc)));
+	__m128i x2 = load(ptr + 16);
+	__m128i x3 = load(ptr + 32);
+	__m128i x4 = load(ptr + 48);
+	__m128i k = _mm_load_si128(reinterpret_cast<const __m128i*>(k1k2));
+	for (ptr += 64, count -= 64; count >= 64; ptr += 64, count -= 64) {
+		x1 = foldCRC32(x1, k, load(ptr));
+		x2 = foldCRC32(x2, k, load(ptr + 16));
+		x3 = foldCRC32(x3, k, load(ptr + 32));
+		x4 = foldCRC32(x4, k, load(ptr + 48));
+	}
+	//fold the four lanes into one, then any 16 byte blocks that are left
+	k = _mm_load_si128(reinterpret_cast<const __m128i*>(k3k4));
+	x1 = foldCRC32(x1, k, x2);
+	x1 = foldCRC32(x1, k, x3);
+	x1 = foldCRC32(x1, k, x4);
+	for (; count >= 16; ptr += 16, count -= 16)
+		x1 = foldCRC32(x1, k, load(ptr));
+
+	//128 bits down to 64
+	__m128i mask = _mm_setr_epi32(~0, 0, ~0, 0);
+	x2 = _mm_clmulepi64_si128(x1, k, 0x10);
+	x1 = _mm_xor_si128(_mm_srli_si128(x1, 8), x2);
+	k = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(k5k0));
+	x2 = _mm_srli_si128(x1, 4);
+	x1 = _mm_xor_si128(_mm_clmulepi64_si128(_mm_and_si128(x1, mask), k, 0x00), x2);
+
+	//Barrett reduction to 32 bits
+	k = _mm_load_si128(reinterpret_cast<const __m128i*>(poly));
+	x2 = _mm_clmulepi64_si128(_mm_and_si128(x1, mask), k, 0x10);
+	x2 = _mm_clmulepi64_si128(_mm_and_si128(x2, mask), k, 0x00);
+	x1 = _mm_xor_si128(x1, x2);
+	return static_cast<std::uint32_t>(_mm_extract_epi32(x1, 1));
+}
+
+bool cpuSupportsClmul() {
+#if defined (_MSC_VER)
+	int registers[4];
+	__cpuid(registers, 1);
+	return (registers[2] & (1 << 1)) && (registers[2] & (1 << 19)); //PCLMULQDQ and SSE4.1
+#else
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("pclmul") && __builtin_cpu_supports("sse4.1");
+#endif
+}
+#endif
+
+//runs the fastest engine the processor supports, decided once on first use
+std::uint32_t calculateBlockCRC32(std::size_t count, std::uint32_t crc, const void* buffer) {
+	const unsigned char* ptr = static_cast<const unsigned char*>(buffer);
+#if defined (CRC32_CLMUL)
+	static const bool useClmul = cpuSupportsClmul();
+	if (useClmul && count >= 64) {
+		std::size_t folded = count & ~std::size_t{ 15 };
+		crc = calculateBlockCRC32Clmul(folded, crc, ptr);
+		ptr += folded;
+		count -= folded;
+	}
+#endif
+	return calculateBlockCRC32Slicing(count, crc, ptr);
+}
+
+//x^(8 * length) mod P is built from the powers x^(2^k) by squaring
+std::uint32_t multiplyModCRC32Polynomial(std::uint32_t a, std::uint32_t b) {
+	std::uint32_t product = 0;
+	for (std::uint32_t m = 1u << 31; m != 0; m >>= 1) {
+		if (a & m)
+			product ^= b;
+		b = (b & 1) ? (b >> 1) ^ static_cast<std::uint32_t>(CRC32_POLYNOMIAL) : b >> 1;
+	}
+	return product;
+}
+
+//The finished CRC-32 of the concatenation of two blocks, from the finished CRCs of each and the length of
+//the second one. Blocks can be checksummed on separate threads and merged in O(log length) afterwards.
+std::uint32_t combineCRC32(std::uint32_t crc1, std::uint32_t crc2, std::uint64_t length2) {
+	std::uint32_t power = 1u << 30; //x^1, the reflected bit order keeps x^0 in the top bit
+	std::uint32_t shift = 1u << 31;
+	for (std::uint64_t n = length2 * 8; n != 0; n >>= 1) {
+		if (n & 1)
+			shift = multiplyModCRC32Polynomial(power, shift);
+		power = multiplyModCRC32Polynomial(power, power);
+	}
+	return multiplyModCRC32Polynomial(shift, crc1) ^ crc2;
+}
+
+
+//Input stage of the compressors. It reads the source in large blocks and runs the CRC and the byte count
+//over each block as it is handed to the codec, so a member is read exactly once and the source never
+//has to be seekable.
+class CRCInputBuffer : public std::streambuf {
+public:
+	static constexpr std::size_t BLOCK_SIZE = 1 << 16;
+
+	explicit CRCInputBuffer(std::streambuf& source) : source{ source }, block(BLOCK_SIZE) {}
+
+	//the finished CRC-32 of everything read so far
+	std::uint32_t crc() const {
+		return runningCRC ^ CRC_MASK;
+	}
+	std::uint64_t size() const {
+		return byteCount;
+	}
+	//condition is asked before each block after the first, the input ends early once it holds
+	void stopWhen(std::function<bool()> condition) {
+		stopCondition = std::move(condition);
+	}
+	bool stopped() const {
+		return stoppedEarly;
+	}
+
+protected:
+	int_type underflow() override {
+		if (gptr() < egptr())
+			return traits_type::to_int_type(*gptr());
+		if (stoppedEarly || (byteCount != 0 && stopCondition && stopCondition())) {
+			stoppedEarly = true;
+			return traits_type::eof();
+		}
+		std::streamsize count = source.sgetn(block.data(), static_cast<std::streamsize>(block.size()));
+		if (count <= 0)
+			return traits_type::eof();
+		runningCRC = calculateBlockCRC32(static_cast<std::size_t>(count), runningCRC, block.data());
+		byteCount += count;
+		setg(block.data(), block.data(), block.data() + count);
+		return traits_type::to_int_type(*gptr());
+	}
+
+private:
+	std::streambuf& source;
+	std::vector<char> block;
+	std::uint32_t runningCRC{ CRC_MASK };
+	std::uint64_t byteCount{ 0 };
+	std::function<bool()> stopCondition;
+	bool stoppedEarly{ false };
+};
@@ -0,0 +1,76 @@
+#pragma once
+#include <cstdint>
+#include <memory>
+#include <iostream>
+#include <string_view>
+#include "BitIO.h"
+#include "OutputSink.h"
+#include "lzss/lzss.h"
+#include "lzw/lzw.h"
+#include "bwt/bw.h"
+#include "ppmc/ppmc.h"
+
+//compression methods as stored in the member headers
+#define METHOD_STORED 0 //the bytes as they are, for data none of the coders can shrink
+#define METHOD_LZW 1
+#define METHOD_LZSS 2
+#define METHOD_BWT 3
+#define METHOD_PPMC 4
+#define PPMC_ORDER 4 //the order members are coded with by METHOD_PPMC, decoders must use the same
+
+//every method the archiver can write, the fastest to expand first
+constexpr int compressionMethods[] = { METHOD_LZSS, METHOD_LZW, METHOD_BWT, METHOD_PPMC };
+
+std::string_view methodName(int method) {
+	switch (method) {
+	case METHOD_STORED:
+		return "stored";
+	case METHOD_LZW:
+		return "LZW";
+	case METHOD_LZSS:
+		return "LZSS";
+	case METHOD_BWT:
+		return "BWT";
+	case METHOD_PPMC:
+		return "PPMC";
+	default:
+		return "unknown";
+	}
+}
+
+void compressWithMethod(int method, std::istream& input, std::unique_ptr<stl::BitFile>& output) {
+	switch (method) {
+	case METHOD_LZW:
+		lzw::LZWCompress(input, output);
+		break;
+	case METHOD_LZSS:
+		lzss::LZSSCompress(input, output);
+		break;
+	case METHOD_BWT:
+		bwt::BWCompress(input, output);
+		break;
+	case METHOD_PPMC:
+		ppmc::compressFile(input, output, PPMC_ORDER);
+		break;
+	}
+}
+
+//returns false when the method is not one this build knows
+bool expandWithMethod(int method, std::unique_ptr<stl::BitFile>& input, OutputSink& output) {
+	switch (method) {
+	case METHOD_LZW:
+		lzw::LZWExpand(input, output);
+		return true;
+	case METHOD_LZSS:
+		lzss::LZSSExpand(input, output);
+		return true;
+	case METHOD_BWT:
+		bwt::BWExpand(input, output);
+		return true;
+	case METHOD_PPMC:
+		ppmc::expandFile(input, output, PPMC_ORDER);
+		return true;
+	default:
+		return false;
+	}
+}
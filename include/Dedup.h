@@ -0,0 +1,165 @@
+#pragma once
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+//Content defined chunking in the style of FastCDC. A Gear hash rolls over the data, each byte shifts the
+//hash left and adds the byte's random table value, so the top bits depend on the last 64 bytes only.
+//A cut is made where the top bits of the hash are all zero, which depends on the content alone, and an
+//insertion early in a file moves only the cuts near it. Below the average size a stricter mask with two
+//more bits is used and above it a looser one with two fewer, which keeps the sizes close to the average.
+
+constexpr std::array<std::uint64_t, 256> makeGearTable() {
+	std::array<std::uint64_t, 256> table{};
+	std::uint64_t state = 0x9e3779b97f4a7c15ull;
+	for (auto& value : table) { //splitmix64
+		std::uint64_t z = (state += 0x9e3779b97f4a7c15ull);
+		z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+		z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+		value = z ^ (z >> 31);
+	}
+	return table;
+}
+
+constexpr auto gearTable = makeGearTable();
+
+class ContentChunker {
+public:
+	//averageSize is rounded down to a power of two, chunks are at least a quarter and at most 8 times that
+	explicit ContentChunker(std::size_t averageSize) {
+		int bits = std::bit_width(std::max<std::size_t>(averageSize, 256)) - 1;
+		averageSize_ = std::size_t{ 1 } << bits;
+		minimumSize_ = averageSize_ / 4;
+		maximumSize_ = averageSize_ * 8;
+		smallMask = ~std::uint64_t{ 0 } << (64 - (bits + 2));
+		largeMask = ~std::uint64_t{ 0 } << (64 - (bits - 2));
+	}
+
+	std::size_t maximumSize() const { return maximumSize_; }
+
+	//the length of the chunk starting at data, size must reach maximumSize() unless the input ends first
+	std::size_t cut(const unsigned char* data, std::size_t size) const {
+		if (size <= minimumSize_)
+			return size;
+		std::size_t end = std::min(size, maximumSize_), normal = std::min(averageSize_, end), i = minimumSize_;
+		std::uint64_t hash{ 0 };
+		for (; i < normal; ++i) {
+			hash = (hash << 1) + gearTable[data[i]];
+			if ((hash & smallMask) == 0)
+				return i + 1;
+		}
+		for (; i < end; ++i) {
+			hash = (hash << 1) + gearTable[data[i]];
+			if ((hash & largeMask) == 0)
+				return i + 1;
+		}
+		return end;
+	}
+
+private:
+	std::size_t averageSize_{};
+	std::size_t minimumSize_{};
+	std::size_t maximumSize_{};
+	std::uint64_t smallMask{};
+	std::uint64_t largeMask{};
+};
+
+//128 bits identify a chunk, see ContentHasher
+struct Fingerprint {
+	std::uint64_t low{};
+	std::uint64_t high{};
+	bool operator==(Fingerprint const&) const = default;
+};
+
+struct FingerprintHash {
+	std::size_t operator()(Fingerprint const& fingerprint) const {
+		return static_cast<std::size_t>(fingerprint.low);
+	}
+};
+
+inline std::uint64_t finalMix64(std::uint64_t k) {
+	k ^= k >> 33;
+	k *= 0xff51afd7ed558ccdull;
+	k ^= k >> 33;
+	k *= 0xc4ceb9fe1a85ec53ull;
+	k ^= k >> 33;
+	return k;
+}
+
+//MurmurHash3 x64 128 of data given in pieces, the same as of the pieces in one. Fast enough to hash whole
+//files with, which is how -a tells an unchanged file from a changed one of the same size.
+class ContentHasher {
+public:
+	void update(const unsigned char* data, std::size_t size) {
+		length += size;
+		if (pending != 0) {
+			std::size_t taken = std::min(size, sizeof tail - pending);
+			std::memcpy(tail + pending, data, taken);
+			pending += taken;
+			data += taken;
+			size -= taken;
+			if (pending < sizeof tail)
+				return;
+			mixBlock(tail);
+			pending = 0;
+		}
+		for (; size >= 16; data += 16, size -= 16)
+			mixBlock(data);
+		if (size != 0)
+			std::memcpy(tail, data, size);
+		pending = size;
+	}
+
+	Fingerprint finish() const {
+		std::uint64_t a = h1, b = h2, k1{ 0 }, k2{ 0 };
+		for (std::size_t j = pending; j-- > 0; ) {
+			if (j >= 8)
+				k2 = (k2 << 8) | tail[j];
+			else
+				k1 = (k1 << 8) | tail[j];
+		}
+		if (pending > 8) {
+			k2 *= c2; k2 = std::rotl(k2, 33); k2 *= c1; b ^= k2;
+		}
+		if (pending > 0) {
+			k1 *= c1; k1 = std::rotl(k1, 31); k1 *= c2; a ^= k1;
+		}
+		a ^= length;
+		b ^= length;
+		a += b;
+		b += a;
+		a = finalMix64(a);
+		b = finalMix64(b);
+		a += b;
+		b += a;
+		return { a, b };
+	}
+
+private:
+	static constexpr std::uint64_t c1 = 0x87c37b91114253d5ull, c2 = 0x4cf5ad432745937full;
+
+	void mixBlock(const unsigned char* block) {
+		std::uint64_t k1, k2;
+		std::memcpy(&k1, block, 8);
+		std::memcpy(&k2, block + 8, 8);
+		k1 *= c1; k1 = std::rotl(k1, 31); k1 *= c2; h1 ^= k1;
+		h1 = std::rotl(h1, 27); h1 += h2; h1 = h1 * 5 + 0x52dce729;
+		k2 *= c2; k2 = std::rotl(k2, 33); k2 *= c1; h2 ^= k2;
+		h2 = std::rotl(h2, 31); h2 += h1; h2 = h2 * 5 + 0x38495ab5;
+	}
+
+	std::uint64_t h1{ 0 };
+	std::uint64_t h2{ 0 };
+	std::uint64_t length{ 0 };
+	unsigned char tail[16]{};
+	std::size_t pending{ 0 };
+};
+
+Fingerprint fingerprintChunk(const unsigned char* data, std::size_t size) {
+	ContentHasher hasher;
+	hasher.update(data, size);
+	return hasher.finish();
+}
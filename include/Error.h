@@ -4,18 +4,36 @@
 
 void usage() {
 	printf("\nQUANTA 1.0: quanta compressed archive manager\n");
-	printf("USAGE: quanta -[command] [archive file] [files...]\n");
+	printf("USAGE: quanta -[command] [options] [pattern] [archive file] [files...]\n");
 	printf("\nx: [extract file from archive]");
 	printf("\nr: [replace files in archive]");
 	printf("\np: [print files in archive to screen]");
+	printf("\nb: [write the bytes offset to offset + length of a file in archive to standard output,");
+	printf("\n    -b archive file offset length, the numbers may end in k, m or g]");
 	printf("\nt: [test files in archive]");
+	printf("\ng: [print the lines of files in archive matching a pattern, given before the archive name]");
 	printf("\nl: [list files in archive]");
-	printf("\na: [add file to archive(replace if present)]");
-	printf("\nd: [delete file from archive]\n");
+	printf("\na: [add file to archive(replace if present), a directory adds the files under it,\n    named by their paths below it]");
+	printf("\nd: [delete file from archive]");
+	printf("\nc: [compact archive, reclaiming the space of replaced and deleted files]");
+	printf("\nz: [compress standard input to standard output, no archive name]");
+	printf("\nu: [expand what z wrote from standard input to standard output, no archive name]\n");
+	printf("\noptions:");
+	printf("\n-j threads: [compress, extract and test on this many threads, all hardware threads by default]");
+	printf("\n-m megabytes: [compressed output held in memory while adding, 256 by default]");
+	printf("\n-e effort: [1 picks each file's method from sample statistics, 2 also trial compresses the sample,");
+	printf("\n            3 tries BWT as well, 2 by default]");
+	printf("\n-w percent: [dead space above which -c compacts, 25 by default]");
+	printf("\n-s megabytes: [add files smaller than this in solid blocks of this size, compressed as one stream]");
+	printf("\n-k kilobytes: [store the content defined chunks of about this size that repeat across files once,");
+	printf("\n            in solid blocks of the -s size or 8 megabytes]");
+	printf("\n-f kilobytes: [add files in frames of this size, each coded on its own, with a table of them so");
+	printf("\n            that -b expands only the frames it needs]\n");
 	exit(0);
 }
 
+//on stderr, so that it stays out of the data -z, -u, -p and -b write to stdout
 void fatalError(std::string const& errorMessage) {
-	printf("ERROR: %s", errorMessage.c_str());
+	fprintf(stderr, "ERROR: %s%s", errorMessage.c_str(), errorMessage.ends_with('\n') ? "" : "\n");
 	exit(1);
 }
\ No newline at end of file
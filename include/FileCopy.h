@@ -0,0 +1,66 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#if defined (__linux__)
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/sendfile.h>
+#include <unistd.h>
+#endif
+
+//Copies byte ranges between two files without passing them through user space. On Linux copy_file_range
+//is tried first, on filesystems with reflinks it lets the target share the source's extents, and sendfile
+//is used where copy_file_range is not supported, e.g between filesystems on older kernels. copy returns
+//how many bytes were transferred, the caller copies whatever is left through its own buffers. Elsewhere
+//nothing is transferred this way.
+class FileRangeCopier {
+public:
+	FileRangeCopier(std::string const& sourcePath, std::string const& targetPath) {
+#if defined (__linux__)
+		source = open(sourcePath.c_str(), O_RDONLY);
+		target = open(targetPath.c_str(), O_WRONLY);
+#endif
+	}
+	FileRangeCopier(FileRangeCopier const&) = delete;
+	FileRangeCopier& operator=(FileRangeCopier const&) = delete;
+	~FileRangeCopier() {
+#if defined (__linux__)
+		if (source >= 0)
+			close(source);
+		if (target >= 0)
+			close(target);
+#endif
+	}
+
+	std::uint64_t copy(std::uint64_t sourceOffset, std::uint64_t targetOffset, std::uint64_t count) {
+		std::uint64_t copied{ 0 };
+#if defined (__linux__)
+		if (source < 0 || target < 0)
+			return 0;
+		while (copied < count && method != Method::None) {
+			off_t from = static_cast<off_t>(sourceOffset + copied);
+			off_t to = static_cast<off_t>(targetOffset + copied);
+			ssize_t result{};
+			if (method == Method::CopyFileRange)
+				result = copy_file_range(source, &from, target, &to, count - copied, 0);
+			else if (lseek(target, to, SEEK_SET) == to)
+				result = sendfile(target, source, &from, count - copied);
+			else
+				result = -1;
+			if (result > 0)
+				copied += result;
+			else if (result < 0 && errno == EINTR)
+				continue;
+			else
+				method = (method == Method::CopyFileRange) ? Method::SendFile : Method::None;
+		}
+#endif
+		return copied;
+	}
+
+private:
+	enum class Method { CopyFileRange, SendFile, None };
+	Method method{ Method::CopyFileRange };
+	int source{ -1 };
+	int target{ -1 };
+};
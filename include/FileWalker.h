@@ -0,0 +1,238 @@
+#pragma once
+#include <algorithm>
+#include <condition_variable>
+#include <cstddef>
+#include <cstring>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "BitIO.h"
+#if defined (__linux__)
+#include <cerrno>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#define MAX_WALK_AHEAD 65536 //entries the walkers may list ahead of the reader before they wait for it
+#define WALK_BUFFER_SIZE (1 << 16) //bytes of directory entries one getdents64 call reads
+
+//a file the walk found and the name it goes by: its path below the directory named, with / between the
+//directories, or for a file named itself, its file name
+struct WalkedFile {
+	std::string path;
+	std::string name;
+};
+
+//Lists the regular files named and those in the directories named, with all the directories under them,
+//for the reader to take one at a time. The order does not depend on the number of threads: the names in
+//the order given, each directory replaced by its entries sorted by name and each subdirectory in turn by
+//its own. Worker threads list directories ahead of the reader, the deepest first as that is where the
+//reader goes next, and the reader takes the files of a directory as soon as it is listed, so work on the
+//first files starts while a large tree is still being walked. The reader lists a directory itself when it
+//gets to one no worker has started. Symbolic links to files are taken, those to directories are not
+//followed, which keeps the walk out of cycles.
+class FileWalker {
+public:
+	FileWalker(std::vector<std::string> const& names, unsigned threads) {
+		root.state = Directory::listed;
+		for (auto& name : names) {
+			std::error_code error;
+			bool directory = std::filesystem::is_directory(name, error);
+			root.entries.push_back({ name, std::filesystem::path(name).filename().string(), directory ? std::make_unique<Directory>(name, "") : nullptr });
+		}
+		publish(root);
+		cursor.push_back({ &root, 0 });
+		for (unsigned i = 0; i < threads; ++i)
+			workers.emplace_back([this] { walk(); });
+	}
+	FileWalker(FileWalker const&) = delete;
+	FileWalker& operator=(FileWalker const&) = delete;
+	~FileWalker() {
+		{
+			std::lock_guard lock{ mutex };
+			stopping = true;
+		}
+		changed.notify_all();
+	}
+
+	//the next file, false once there are no more. A directory that could not be read is reported as
+	//stl::FileError, and the workers stop when the walker goes.
+	bool next(WalkedFile& file) {
+		std::unique_lock lock{ mutex };
+		while (!cursor.empty()) {
+			Directory* directory = cursor.back().directory;
+			if (directory->state == Directory::waiting) {
+				pending.erase(std::find(std::begin(pending), std::end(pending), directory));
+				list(*directory, lock);
+				continue;
+			}
+			changed.wait(lock, [directory] { return directory->state == Directory::listed; });
+			if (!directory->error.empty())
+				throw stl::FileError(directory->error + "\n");
+			std::size_t index = cursor.back().index++;
+			if (index == directory->entries.size()) {
+				cursor.pop_back();
+				if (!cursor.empty()) //all of it has been taken
+					cursor.back().directory->entries[cursor.back().index - 1].directory.reset();
+				continue;
+			}
+			if (--buffered == MAX_WALK_AHEAD - 1)
+				changed.notify_all();
+			Entry& entry = directory->entries[index];
+			if (entry.directory)
+				cursor.push_back({ entry.directory.get(), 0 });
+			else {
+				file.path = std::move(entry.path);
+				file.name = std::move(entry.name);
+				return true;
+			}
+		}
+		return false;
+	}
+
+private:
+	struct Directory;
+	struct Entry {
+		std::string path;
+		std::string name;
+		std::unique_ptr<Directory> directory; //nullptr for a file
+	};
+	struct Directory {
+		enum State { waiting, listing, listed };
+		Directory() = default;
+		Directory(std::string const& path, std::string const& name) : path{ path }, name{ name } {}
+		std::string path;
+		std::string name; //below the directory named, empty for that one
+		std::vector<Entry> entries;
+		State state{ waiting };
+		std::string error; //why it could not be listed
+	};
+	struct Position {
+		Directory* directory;
+		std::size_t index; //of the next entry to take
+	};
+
+	void walk() {
+		std::unique_lock lock{ mutex };
+		for (;;) {
+			changed.wait(lock, [this] {
+				return stopping || (pending.empty() && listing == 0) || (!pending.empty() && buffered < MAX_WALK_AHEAD);
+			});
+			if (stopping || pending.empty())
+				return;
+			Directory* directory = pending.back();
+			pending.pop_back();
+			list(*directory, lock);
+		}
+	}
+
+	//reads the directory with the lock released, then hands its entries to the reader
+	void list(Directory& directory, std::unique_lock<std::mutex>& lock) {
+		directory.state = Directory::listing;
+		++listing;
+		lock.unlock();
+		read(directory);
+		std::sort(std::begin(directory.entries), std::end(directory.entries), [](Entry const& a, Entry const& b) { return a.path < b.path; });
+		lock.lock();
+		--listing;
+		directory.state = Directory::listed;
+		publish(directory);
+		changed.notify_all();
+	}
+
+	//counts the entries of a listed directory as waiting for the reader and queues its subdirectories, the
+	//first of them on top
+	void publish(Directory& directory) {
+		buffered += directory.entries.size();
+		for (auto entry = directory.entries.rbegin(); entry != directory.entries.rend(); ++entry) {
+			if (entry->directory)
+				pending.push_back(entry->directory.get());
+		}
+	}
+
+	void add(Directory& directory, const char* name, bool isDirectory) {
+		std::string path = directory.path;
+		if (!path.ends_with('/') && !path.ends_with('\\'))
+			path += '/';
+		path += name;
+		std::string entryName = directory.name.empty() ? name : directory.name + '/' + name;
+		auto subdirectory = isDirectory ? std::make_unique<Directory>(path, entryName) : nullptr;
+		directory.entries.push_back({ std::move(path), std::move(entryName), std::move(subdirectory) });
+	}
+
+#if defined (__linux__)
+	//The entries come a buffer at a time from getdents64 with their types, so no file needs a stat of its
+	//own unless the file system leaves the type out or it is a symbolic link.
+	void read(Directory& directory) {
+		int descriptor = open(directory.path.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+		if (descriptor < 0) {
+			directory.error = "quanta could not read the directory " + directory.path;
+			return;
+		}
+		std::vector<char> buffer(WALK_BUFFER_SIZE);
+		for (;;) {
+			long count = syscall(SYS_getdents64, descriptor, buffer.data(), buffer.size());
+			if (count < 0 && errno == EINTR)
+				continue;
+			if (count < 0)
+				directory.error = "quanta could not read the directory " + directory.path;
+			if (count <= 0)
+				break;
+			for (long offset = 0; offset < count; ) { //records of inode, offset, length, type and name
+				const char* record = buffer.data() + offset;
+				unsigned short length;
+				std::memcpy(&length, record + 16, sizeof length);
+				offset += length;
+				const char* name = record + 19;
+				if (std::strcmp(name, ".") == 0 || std::strcmp(name, "..") == 0)
+					continue;
+				unsigned char type = entryType(descriptor, name, static_cast<unsigned char>(record[18]));
+				if (type == DT_REG || type == DT_DIR)
+					add(directory, name, type == DT_DIR);
+			}
+		}
+		close(descriptor);
+	}
+
+	static unsigned char entryType(int descriptor, const char* name, unsigned char type) {
+		struct stat status;
+		if (type == DT_UNKNOWN) {
+			if (fstatat(descriptor, name, &status, AT_SYMLINK_NOFOLLOW) != 0)
+				return DT_UNKNOWN;
+			type = S_ISLNK(status.st_mode) ? DT_LNK : S_ISDIR(status.st_mode) ? DT_DIR : S_ISREG(status.st_mode) ? DT_REG : DT_UNKNOWN;
+		}
+		if (type == DT_LNK)
+			return fstatat(descriptor, name, &status, 0) == 0 && S_ISREG(status.st_mode) ? DT_REG : DT_UNKNOWN;
+		return type;
+	}
+#else
+	void read(Directory& directory) {
+		std::error_code error;
+		for (std::filesystem::directory_iterator entry{ directory.path, error }, end; !error && entry != end; entry.increment(error)) {
+			std::error_code typeError;
+			if (entry->is_directory(typeError) && !entry->is_symlink(typeError))
+				add(directory, entry->path().filename().string().c_str(), true);
+			else if (entry->is_regular_file(typeError))
+				add(directory, entry->path().filename().string().c_str(), false);
+		}
+		if (error)
+			directory.error = "quanta could not read the directory " + directory.path;
+	}
+#endif
+
+	Directory root; //holds the names given
+	std::vector<Position> cursor; //the directories the reader is in, innermost last
+	std::vector<Directory*> pending; //directories no one has started on, the next to list last
+	std::size_t buffered{ 0 }; //entries listed and not yet taken
+	unsigned listing{ 0 };
+	bool stopping{ false };
+	std::mutex mutex;
+	std::condition_variable changed;
+	std::vector<std::jthread> workers; //last, so they are joined before the rest goes
+};
@@ -0,0 +1,76 @@
+#pragma once
+#include <cstddef>
+#include <string>
+#include "BitIO.h"
+#if defined (_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#elif defined (__linux__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+//Maps a whole file into memory. A read only view shares the pages with the page cache. A copy on write view
+//can be modified, the writing process gets private copies of the pages it touches and the file itself is
+//never changed. An empty file maps to nullptr. Failures are reported as stl::FileError.
+class MappedFile {
+public:
+	enum class Access { ReadOnly, CopyOnWrite };
+
+	MappedFile(std::string const& path, Access access) {
+		bool copyOnWrite = (access == Access::CopyOnWrite);
+#if defined (_WIN32)
+		HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+		if (file == INVALID_HANDLE_VALUE)
+			throw stl::FileError("Can't open " + path);
+		LARGE_INTEGER fileSize{};
+		GetFileSizeEx(file, &fileSize);
+		length = static_cast<std::size_t>(fileSize.QuadPart);
+		HANDLE mapping = (length != 0) ? CreateFileMappingA(file, nullptr, copyOnWrite ? PAGE_WRITECOPY : PAGE_READONLY, 0, 0, nullptr) : nullptr;
+		if (mapping) {
+			view = static_cast<char*>(MapViewOfFile(mapping, copyOnWrite ? FILE_MAP_COPY : FILE_MAP_READ, 0, 0, 0));
+			CloseHandle(mapping);
+		}
+		CloseHandle(file);
+#elif defined (__linux__)
+		int file = open(path.c_str(), O_RDONLY);
+		if (file < 0)
+			throw stl::FileError("Can't open " + path);
+		struct stat status {};
+		fstat(file, &status);
+		length = static_cast<std::size_t>(status.st_size);
+		if (length != 0) {
+			void* mapped = mmap(nullptr, length, copyOnWrite ? PROT_READ | PROT_WRITE : PROT_READ, MAP_PRIVATE, file, 0);
+			view = (mapped == MAP_FAILED) ? nullptr : static_cast<char*>(mapped);
+		}
+		close(file);
+#endif
+		if (!view && length != 0)
+			throw stl::FileError("Can't map " + path);
+	}
+	MappedFile(MappedFile const&) = delete;
+	MappedFile& operator=(MappedFile const&) = delete;
+	~MappedFile() {
+		if (!view)
+			return;
+#if defined (_WIN32)
+		UnmapViewOfFile(view);
+#elif defined (__linux__)
+		munmap(view, length);
+#endif
+	}
+
+	char* data() const {
+		return view;
+	}
+	std::size_t size() const {
+		return length;
+	}
+
+private:
+	char* view{ nullptr };
+	std::size_t length{ 0 };
+};
@@ -0,0 +1,213 @@
+#pragma once
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "Codecs.h"
+
+#define SAMPLE_WINDOW_SIZE (64 << 10)
+#define SAMPLE_WINDOWS 3 //taken from the start, the middle and the end of a file
+#define MIN_MATCH_LENGTH 4
+#define MIN_GAIN_PERCENT 2 //a slower method has to save this share of the sample over a faster one
+#define STORED_ENTROPY 7.9 //order 0 bits per byte above which a sample with almost no matches is stored untried
+#define STORED_MAX_MATCHED 0.02
+
+//What a sample of a file says about how it will compress. Entropies are in bits per byte, the order 0
+//one bounds coders that look at bytes in isolation, the order 1 one those that look at the previous byte.
+//matchedFraction is the share of the sample an LZ coder with a window of lzss::WINDOW_SIZE could cover
+//with matches of MIN_MATCH_LENGTH bytes or more.
+struct SampleStatistics {
+	double order0Entropy{};
+	double order1Entropy{};
+	double matchedFraction{};
+};
+
+struct MethodTrial {
+	int method{};
+	std::uint64_t compressedSize{};
+};
+
+struct MethodChoice {
+	int method{ METHOD_LZSS };
+	std::uint64_t fileSize{};
+	std::uint64_t sampleSize{};
+	SampleStatistics statistics;
+	std::vector<MethodTrial> trials; //empty when the choice was made from the statistics alone
+};
+
+//Data that fits in the windows is taken whole, otherwise the windows are spread over it. read(offset,
+//destination, count) fetches count bytes at offset.
+template <typename Read>
+std::string takeSample(std::uint64_t size, Read read) {
+	std::uint64_t window = SAMPLE_WINDOW_SIZE;
+	std::string sample;
+	if (size <= window * SAMPLE_WINDOWS) {
+		sample.resize(size);
+		sample.resize(read(0, sample.data(), size));
+		return sample;
+	}
+	sample.resize(window * SAMPLE_WINDOWS);
+	for (int i = 0; i < SAMPLE_WINDOWS; ++i)
+		read((size - window) * i / (SAMPLE_WINDOWS - 1), sample.data() + window * i, window);
+	return sample;
+}
+
+std::string readSample(std::string const& path, std::uint64_t& fileSize) {
+	std::ifstream input{ path, std::ios_base::binary | std::ios_base::ate };
+	if (!input.is_open())
+		return {};
+	fileSize = static_cast<std::uint64_t>(input.tellg());
+	return takeSample(fileSize, [&input](std::uint64_t offset, char* destination, std::uint64_t count) {
+		input.seekg(offset);
+		input.read(destination, count);
+		return static_cast<std::uint64_t>(input.gcount());
+	});
+}
+
+SampleStatistics analyzeSample(std::string_view sample) {
+	SampleStatistics statistics;
+	if (sample.empty())
+		return statistics;
+	std::vector<std::uint32_t> counts(256), pairCounts(256 * 256);
+	unsigned char previous{ 0 };
+	for (unsigned char c : sample) {
+		++counts[c];
+		++pairCounts[(previous << 8) | c];
+		previous = c;
+	}
+	double total = static_cast<double>(sample.size());
+	for (int c = 0; c < 256; ++c) {
+		if (counts[c] != 0)
+			statistics.order0Entropy -= counts[c] / total * std::log2(counts[c] / total);
+	}
+	for (int context = 0; context < 256; ++context) {
+		std::uint32_t contextTotal{ 0 };
+		for (int c = 0; c < 256; ++c)
+			contextTotal += pairCounts[(context << 8) | c];
+		for (int c = 0; c < 256; ++c) {
+			if (std::uint32_t count = pairCounts[(context << 8) | c])
+				statistics.order1Entropy -= count / total * std::log2(static_cast<double>(count) / contextTotal);
+		}
+	}
+	//greedy parse with the last position seen for each hash of MIN_MATCH_LENGTH bytes
+	std::vector<std::uint32_t> lastSeen(1 << 16, UINT32_MAX);
+	std::uint64_t matched{ 0 };
+	auto data = reinterpret_cast<const unsigned char*>(sample.data());
+	for (std::size_t i = 0; i + MIN_MATCH_LENGTH <= sample.size(); ) {
+		std::uint32_t key = data[i] | (data[i + 1] << 8) | (data[i + 2] << 16) | (static_cast<std::uint32_t>(data[i + 3]) << 24);
+		std::uint32_t hash = (key * 2654435761u) >> 16;
+		std::uint32_t candidate = lastSeen[hash];
+		lastSeen[hash] = static_cast<std::uint32_t>(i);
+		std::size_t length{ 0 };
+		if (candidate != UINT32_MAX && i - candidate < lzss::WINDOW_SIZE) {
+			while (i + length < sample.size() && length <= lzss::LOOK_AHEAD_SIZE && data[candidate + length] == data[i + length])
+				++length;
+		}
+		if (length >= MIN_MATCH_LENGTH) {
+			matched += length;
+			i += length;
+		}
+		else
+			++i;
+	}
+	statistics.matchedFraction = matched / total;
+	return statistics;
+}
+
+std::uint64_t trialCompressedSize(int method, std::string const& sample) {
+	std::istringstream input{ sample };
+	std::stringstream output;
+	auto bitFile = stl::attachBitFile(output);
+	compressWithMethod(method, input, bitFile);
+	stl::closeOutputBitFile(bitFile);
+	return static_cast<std::uint64_t>(output.tellp());
+}
+
+//Without trials: LZSS when most of the sample repeats within its window, PPMC when the previous byte
+//predicts the next one much better than the byte frequencies alone, LZW otherwise.
+int methodFromStatistics(SampleStatistics const& statistics) {
+	if (statistics.matchedFraction >= 0.5)
+		return METHOD_LZSS;
+	if (statistics.order1Entropy < statistics.order0Entropy - 1.0)
+		return METHOD_PPMC;
+	return METHOD_LZW;
+}
+
+//already compressed data, media and archives, looks like noise to every coder
+bool looksIncompressible(SampleStatistics const& statistics) {
+	return statistics.order0Entropy > STORED_ENTROPY && statistics.matchedFraction < STORED_MAX_MATCHED;
+}
+
+//Picks the method for data whose sample is given. Samples that look incompressible are stored without
+//trying anything. Otherwise effort 1 decides from the sample statistics, effort 2 compresses the sample
+//with LZSS, LZW and PPMC and effort 3 with BWT as well. The smallest trial wins, except that a method
+//later in compressionMethods, which is slower, has to beat the best earlier one by MIN_GAIN_PERCENT,
+//and the data is stored when no trial shrinks the sample.
+MethodChoice selectMethodForSample(std::string const& sample, std::uint64_t size, unsigned effort) {
+	MethodChoice choice;
+	choice.fileSize = size;
+	choice.sampleSize = sample.size();
+	choice.statistics = analyzeSample(sample);
+	if (sample.empty() || looksIncompressible(choice.statistics)) {
+		choice.method = METHOD_STORED;
+		return choice;
+	}
+	if (effort <= 1) {
+		choice.method = methodFromStatistics(choice.statistics);
+		return choice;
+	}
+	std::uint64_t bestSize{ UINT64_MAX };
+	for (int method : compressionMethods) {
+		if (method == METHOD_BWT && effort < 3)
+			continue;
+		MethodTrial trial{ method, trialCompressedSize(method, sample) };
+		choice.trials.push_back(trial);
+		if (bestSize == UINT64_MAX || trial.compressedSize * 100 + sample.size() * MIN_GAIN_PERCENT <= bestSize * 100) {
+			bestSize = trial.compressedSize;
+			choice.method = method;
+		}
+	}
+	if (bestSize >= choice.sampleSize)
+		choice.method = METHOD_STORED;
+	return choice;
+}
+
+MethodChoice selectMethod(std::string const& path, unsigned effort) {
+	std::uint64_t fileSize{ 0 };
+	std::string sample = readSample(path, fileSize);
+	return selectMethodForSample(sample, fileSize, effort);
+}
+
+//for data already in memory, such as a solid block
+MethodChoice selectMethod(std::string_view data, unsigned effort) {
+	std::string sample = takeSample(data.size(), [data](std::uint64_t offset, char* destination, std::uint64_t count) {
+		return static_cast<std::uint64_t>(data.copy(destination, count, offset));
+	});
+	return selectMethodForSample(sample, data.size(), effort);
+}
+
+//one line for the log, e.g "H0 4.71 H1 3.02 bits/byte, 38% matched; LZSS 29% LZW 31% PPMC 17% -> PPMC, saves ~1612.3 KB"
+std::string describeChoice(MethodChoice const& choice) {
+	char buffer[128];
+	snprintf(buffer, sizeof buffer, "H0 %.2f H1 %.2f bits/byte, %d%% matched;", choice.statistics.order0Entropy,
+		choice.statistics.order1Entropy, static_cast<int>(100 * choice.statistics.matchedFraction));
+	std::string description = buffer;
+	double chosenRatio{ -1.0 };
+	for (auto& trial : choice.trials) {
+		double ratio = static_cast<double>(trial.compressedSize) / choice.sampleSize;
+		if (trial.method == choice.method)
+			chosenRatio = ratio;
+		snprintf(buffer, sizeof buffer, " %s %d%%", std::string{ methodName(trial.method) }.c_str(), static_cast<int>(100 * ratio));
+		description += buffer;
+	}
+	description += " -> " + std::string{ methodName(choice.method) };
+	if (chosenRatio >= 0.0) {
+		snprintf(buffer, sizeof buffer, ", saves ~%.1f KB", choice.fileSize * (1.0 - chosenRatio) / 1024);
+		description += buffer;
+	}
+	return description;
+}
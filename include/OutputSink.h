@@ -0,0 +1,128 @@
+#pragma once
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <streambuf>
+#include <string>
+#include <vector>
+#include "CRC32.h"
+
+//Where the expanders put what they decode. put is inline and only stores into the sink's buffer, with no
+//stream sentry or virtual call per byte, and the buffer is handed to consume a block at a time while it
+//is still in cache. The sinks differ only in consume. Call flush once the output is complete.
+class OutputSink {
+public:
+	static constexpr std::size_t BLOCK_SIZE = 1 << 16;
+
+	OutputSink() : buffer(BLOCK_SIZE), next{ buffer.data() }, end{ buffer.data() + buffer.size() } {}
+	OutputSink(OutputSink const&) = delete;
+	OutputSink& operator=(OutputSink const&) = delete;
+	virtual ~OutputSink() = default;
+
+	void put(char c) {
+		if (next == end)
+			flush();
+		*next++ = c;
+	}
+	void write(const char* data, std::size_t count) {
+		if (count >= BLOCK_SIZE) { //too large to be worth buffering
+			flush();
+			if (!consume(data, count))
+				failed = true;
+			return;
+		}
+		while (count != 0) {
+			if (next == end)
+				flush();
+			std::size_t part = std::min(count, static_cast<std::size_t>(end - next));
+			std::memcpy(next, data, part);
+			next += part;
+			data += part;
+			count -= part;
+		}
+	}
+	//hands on what is buffered, returns false once consume has failed
+	bool flush() {
+		std::size_t count = static_cast<std::size_t>(next - buffer.data());
+		next = buffer.data();
+		if (count != 0 && !consume(buffer.data(), count))
+			failed = true;
+		return !failed;
+	}
+
+protected:
+	virtual bool consume(const char* data, std::size_t count) = 0;
+
+private:
+	std::vector<char> buffer;
+	char* next;
+	char* end;
+	bool failed{ false };
+};
+
+//Takes the CRC and size of the output on its way to target. Without a target the output is discarded,
+//which is all -t needs: the data is checked as it is decoded and never written anywhere.
+class CRCSink : public OutputSink {
+public:
+	explicit CRCSink(std::streambuf* target = nullptr) : target{ target } {}
+
+	//the finished CRC-32 of everything consumed so far, flush first
+	std::uint32_t crc() const {
+		return runningCRC ^ CRC_MASK;
+	}
+	std::uint64_t size() const {
+		return byteCount;
+	}
+
+protected:
+	bool consume(const char* data, std::size_t count) override {
+		runningCRC = calculateBlockCRC32(count, runningCRC, data);
+		byteCount += count;
+		return !target || target->sputn(data, static_cast<std::streamsize>(count)) == static_cast<std::streamsize>(count);
+	}
+
+private:
+	std::streambuf* target;
+	std::uint32_t runningCRC{ CRC_MASK };
+	std::uint64_t byteCount{ 0 };
+};
+
+//appends the output to a string
+class StringSink : public OutputSink {
+public:
+	explicit StringSink(std::string& target) : target{ target } {}
+
+protected:
+	bool consume(const char* data, std::size_t count) override {
+		target.append(data, count);
+		return true;
+	}
+
+private:
+	std::string& target;
+};
+
+//Passes on to target the part of what goes through it from offset to offset + length, counting from start,
+//while taking the CRC of all of it.
+class RangeSink : public CRCSink {
+public:
+	RangeSink(OutputSink& target, std::uint64_t start, std::uint64_t offset, std::uint64_t length)
+		: target{ target }, position{ start }, offset{ offset }, end{ offset + length } {}
+
+protected:
+	bool consume(const char* data, std::size_t count) override {
+		CRCSink::consume(data, count);
+		std::uint64_t from = std::max(position, offset), to = std::min(position + count, end);
+		if (from < to)
+			target.write(data + (from - position), static_cast<std::size_t>(to - from));
+		position += count;
+		return true;
+	}
+
+private:
+	OutputSink& target;
+	std::uint64_t position;
+	std::uint64_t offset;
+	std::uint64_t end;
+};
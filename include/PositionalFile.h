@@ -0,0 +1,117 @@
+#pragma once
+#include <algorithm>
+#include <cstdint>
+#include <fstream>
+#include <mutex>
+#include <streambuf>
+#include <string>
+#include <vector>
+#if defined (__linux__)
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+//An output file several threads write at once, each at its own offsets. On Linux every write is a pwrite,
+//which leaves the file position alone, so the writes need no ordering between them. Elsewhere they go
+//through one stream, a seek and a write at a time.
+class PositionalFile {
+public:
+	explicit PositionalFile(std::string const& path) {
+#if defined (__linux__)
+		descriptor = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+#else
+		file.open(path, std::ios_base::out | std::ios_base::binary | std::ios_base::trunc);
+#endif
+	}
+	PositionalFile(PositionalFile const&) = delete;
+	PositionalFile& operator=(PositionalFile const&) = delete;
+	~PositionalFile() {
+		close();
+	}
+
+	bool isOpen() const {
+#if defined (__linux__)
+		return descriptor >= 0;
+#else
+		return file.is_open();
+#endif
+	}
+
+	//returns false once a write has failed
+	bool write(std::uint64_t offset, const char* data, std::size_t count) {
+#if defined (__linux__)
+		while (count != 0) {
+			ssize_t written = pwrite(descriptor, data, count, static_cast<off_t>(offset));
+			if (written < 0 && errno == EINTR)
+				continue;
+			if (written <= 0)
+				return false;
+			data += written;
+			offset += written;
+			count -= written;
+		}
+		return true;
+#else
+		std::lock_guard lock{ mutex };
+		file.seekp(offset);
+		file.write(data, count);
+		return static_cast<bool>(file);
+#endif
+	}
+
+	void close() {
+#if defined (__linux__)
+		if (descriptor >= 0)
+			::close(descriptor);
+		descriptor = -1;
+#else
+		file.close();
+#endif
+	}
+
+private:
+#if defined (__linux__)
+	int descriptor{ -1 };
+#else
+	std::fstream file;
+	std::mutex mutex;
+#endif
+};
+
+//buffers what is written to it and hands it to a PositionalFile from offset on
+class PositionalOutputBuffer : public std::streambuf {
+public:
+	static constexpr std::size_t BLOCK_SIZE = 1 << 16;
+
+	PositionalOutputBuffer(PositionalFile& file, std::uint64_t offset) : file{ file }, offset{ offset }, block(BLOCK_SIZE) {
+		setp(block.data(), block.data() + block.size());
+	}
+	~PositionalOutputBuffer() override {
+		sync();
+	}
+
+protected:
+	int_type overflow(int_type c) override {
+		if (sync() != 0)
+			return traits_type::eof();
+		if (!traits_type::eq_int_type(c, traits_type::eof())) {
+			*pptr() = traits_type::to_char_type(c);
+			pbump(1);
+		}
+		return traits_type::not_eof(c);
+	}
+	int sync() override {
+		std::size_t count = static_cast<std::size_t>(pptr() - pbase());
+		setp(block.data(), block.data() + block.size());
+		if (count != 0 && !file.write(offset, block.data(), count))
+			return -1;
+		offset += count;
+		return 0;
+	}
+
+private:
+	PositionalFile& file;
+	std::uint64_t offset;
+	std::vector<char> block;
+};
@@ -0,0 +1,307 @@
+#pragma once
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <bitset>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "Error.h"
+#include "OutputSink.h"
+#if defined (__x86_64__) || defined (_M_X64)
+#include <emmintrin.h>
+#define SEARCH_SSE2
+#endif
+
+#define MAX_PATTERN_ATOMS 63 //the states of a pattern are the bits of a 64 bit word, the last one accepts
+#define MAX_SEARCH_LINE (1 << 20) //longer lines are matched in pieces of this size
+
+//The first occurrence of needle in the size bytes at data, or nullptr. 16 positions are tried at once:
+//those where both the first and the last byte of the needle match are compared in full, which for text
+//leaves few candidates. SSE2 is part of every x86-64 processor, elsewhere it falls back to std::search.
+const char* findLiteral(const char* data, std::size_t size, std::string_view needle) {
+	std::size_t length = needle.size();
+	if (length == 0)
+		return data;
+	if (length > size)
+		return nullptr;
+	if (length == 1)
+		return static_cast<const char*>(std::memchr(data, needle[0], size));
+	std::size_t last = size - length, i{ 0 };
+#if defined (SEARCH_SSE2)
+	const __m128i first = _mm_set1_epi8(needle.front()), final = _mm_set1_epi8(needle.back());
+	for (; i + 16 <= last + 1; i += 16) {
+		__m128i head = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+		__m128i tail = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i + length - 1));
+		unsigned mask = static_cast<unsigned>(_mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(head, first), _mm_cmpeq_epi8(tail, final))));
+		while (mask != 0) {
+			int bit = std::countr_zero(mask);
+			if (std::memcmp(data + i + bit + 1, needle.data() + 1, length - 2) == 0)
+				return data + i + bit;
+			mask &= mask - 1;
+		}
+	}
+#endif
+	const char* found = std::search(data + i, data + size, needle.begin(), needle.end());
+	return found == data + size ? nullptr : found;
+}
+
+//A regular expression of the simple kind: literal characters, . for any character, [] classes with ranges
+//and ^ for negation, the quantifiers * + ? after any of those, \ to take the next character literally, and
+//^ and $ anchoring at the start and end of a line. A line matches when some part of it does.
+//Matching runs every start position at once, each state is one bit of a word and a line is read once,
+//so the time is linear in the line whatever the pattern.
+class LinePattern {
+public:
+	explicit LinePattern(std::string_view pattern) {
+		if (!pattern.empty() && pattern.front() == '^') {
+			anchoredStart = true;
+			pattern.remove_prefix(1);
+		}
+		if (!pattern.empty() && pattern.back() == '$' && (pattern.size() < 2 || pattern[pattern.size() - 2] != '\\')) {
+			anchoredEnd = true;
+			pattern.remove_suffix(1);
+		}
+		for (std::size_t i = 0; i < pattern.size(); ) {
+			Atom atom;
+			char c = pattern[i++];
+			if (c == '.')
+				atom.characters.set();
+			else if (c == '[')
+				i = parseClass(pattern, i, atom.characters);
+			else {
+				if (c == '\\' && i < pattern.size())
+					c = pattern[i++];
+				atom.characters.set(static_cast<unsigned char>(c));
+				atom.literal = c;
+			}
+			if (i < pattern.size() && (pattern[i] == '*' || pattern[i] == '+' || pattern[i] == '?'))
+				atom.quantifier = pattern[i++];
+			atoms.push_back(atom);
+		}
+		if (atoms.size() > MAX_PATTERN_ATOMS)
+			fatalError("The search pattern is too long\n");
+		for (std::size_t i = 0; i < atoms.size(); ++i) {
+			std::uint64_t bit = std::uint64_t{ 1 } << i;
+			for (int c = 0; c < 256; ++c) {
+				if (atoms[i].characters.test(c))
+					transitions[c] |= bit;
+			}
+			if (atoms[i].quantifier == '*' || atoms[i].quantifier == '+')
+				repeating |= bit;
+			if (atoms[i].quantifier == '*' || atoms[i].quantifier == '?')
+				optional |= bit;
+		}
+		accept = std::uint64_t{ 1 } << atoms.size();
+		start = closure(1);
+		findRequiredLiteral();
+	}
+
+	//a run of characters every match contains, used to find the lines worth matching
+	std::string const& requiredLiteral() const {
+		return literal;
+	}
+
+	bool matches(const char* line, std::size_t length) const {
+		if (findLiteral(line, length, literal) == nullptr)
+			return false;
+		if (literalOnly)
+			return true;
+		std::uint64_t states = start;
+		for (std::size_t i = 0; i < length; ++i) {
+			if ((states & accept) && !anchoredEnd)
+				return true;
+			std::uint64_t matched = states & transitions[static_cast<unsigned char>(line[i])];
+			states = closure(matched << 1) | (matched & repeating);
+			if (!anchoredStart)
+				states |= start;
+			if (states == 0)
+				return false;
+		}
+		return (states & accept) != 0;
+	}
+
+private:
+	struct Atom {
+		std::bitset<256> characters;
+		char quantifier{};
+		int literal{ -1 }; //the character of a plain atom
+	};
+
+	static std::size_t parseClass(std::string_view pattern, std::size_t i, std::bitset<256>& characters) {
+		bool negated = i < pattern.size() && pattern[i] == '^';
+		if (negated)
+			++i;
+		for (bool first = true; i < pattern.size() && (pattern[i] != ']' || first); first = false) {
+			unsigned char low = static_cast<unsigned char>(pattern[i++]), high = low;
+			if (i + 1 < pattern.size() && pattern[i] == '-' && pattern[i + 1] != ']') {
+				high = static_cast<unsigned char>(pattern[i + 1]);
+				i += 2;
+			}
+			for (unsigned c = low; c <= high; ++c)
+				characters.set(c);
+		}
+		if (i == pattern.size())
+			fatalError("Unterminated [ in the search pattern\n");
+		if (negated)
+			characters.flip();
+		return i + 1;
+	}
+
+	//adds the states reached from these by skipping atoms that may match nothing
+	std::uint64_t closure(std::uint64_t states) const {
+		for (std::uint64_t skipped = states & optional; skipped != 0; ) {
+			std::uint64_t reached = (skipped << 1) & ~states;
+			states |= reached;
+			skipped = reached & optional;
+		}
+		return states;
+	}
+
+	//the longest run of plain atoms that must each match once
+	void findRequiredLiteral() {
+		std::string run;
+		for (auto& atom : atoms) {
+			if (atom.literal >= 0 && atom.quantifier != '*' && atom.quantifier != '?')
+				run += static_cast<char>(atom.literal);
+			if (atom.literal < 0 || atom.quantifier != 0) {
+				if (run.size() > literal.size())
+					literal = run;
+				run.clear();
+			}
+		}
+		if (run.size() > literal.size())
+			literal = run;
+		literalOnly = !anchoredStart && !anchoredEnd && literal.size() == atoms.size() && std::all_of(std::begin(atoms), std::end(atoms),
+			[](Atom const& atom) { return atom.literal >= 0 && atom.quantifier == 0; });
+	}
+
+	std::vector<Atom> atoms;
+	std::array<std::uint64_t, 256> transitions{}; //the states each character moves on from
+	std::uint64_t repeating{}; //states that may match again after matching
+	std::uint64_t optional{}; //states that may be skipped
+	std::uint64_t start{};
+	std::uint64_t accept{};
+	bool anchoredStart{ false };
+	bool anchoredEnd{ false };
+	std::string literal;
+	bool literalOnly{ false };
+};
+
+//What searching one piece of a member found. A piece that starts within the member may start within a
+//line, so what comes before its first newline is left in head, and what follows its last newline in tail,
+//for the pieces to be joined in order.
+struct SearchPiece {
+	std::string matches; //a "name:offset:line" line for each line that matched
+	std::size_t matchCount{};
+	std::string head;
+	bool headEnded{ false }; //head ends in a newline, otherwise the piece held no newline at all
+	std::string tail;
+	std::uint64_t tailOffset{};
+};
+
+//Matches the lines of what is decoded into it as it goes by, while taking its CRC. offset is where the
+//data starts in the member, startsLine is false when that may be within a line. Runs of whole lines are
+//matched where they lie in the buffer, a line is copied only when it spans two buffers. Lines with a
+//NUL byte in them are reported without being printed.
+class LineSearchSink : public CRCSink {
+public:
+	LineSearchSink(LinePattern const& pattern, std::string const& name, std::uint64_t offset, bool startsLine, SearchPiece& piece)
+		: pattern{ pattern }, name{ name }, offset{ offset }, partialOffset{ offset }, inHead{ !startsLine }, piece{ piece } {}
+
+	//Ends the data. The open line is matched when the data ends the member, otherwise it goes to the tail.
+	void finish(bool endsMember) {
+		flush();
+		if (inHead) {
+			piece.head = std::move(partial);
+			inHead = false;
+		}
+		else if (endsMember) {
+			if (!partial.empty())
+				searchLine(partial.data(), partial.size(), partialOffset);
+		}
+		else {
+			piece.tailOffset = partial.empty() ? offset : partialOffset;
+			piece.tail = std::move(partial);
+		}
+		partial.clear();
+	}
+
+protected:
+	bool consume(const char* data, std::size_t count) override {
+		bool written = CRCSink::consume(data, count);
+		const char* end = data + count;
+		while (data != end) {
+			if (partial.empty() && !inHead) {
+				auto last = std::find(std::make_reverse_iterator(end), std::make_reverse_iterator(data), '\n');
+				if (last.base() != data) {
+					searchLines(data, last.base());
+					offset += last.base() - data;
+					data = last.base();
+					continue;
+				}
+			}
+			auto newline = static_cast<const char*>(std::memchr(data, '\n', end - data));
+			const char* next = newline ? newline + 1 : end;
+			if (partial.empty())
+				partialOffset = offset;
+			partial.append(data, next);
+			offset += next - data;
+			data = next;
+			if (newline != nullptr || (!inHead && partial.size() >= MAX_SEARCH_LINE))
+				endLine();
+		}
+		return written;
+	}
+
+private:
+	void endLine() {
+		if (inHead) {
+			piece.head = std::move(partial);
+			piece.headEnded = true;
+			inHead = false;
+		}
+		else
+			searchLine(partial.data(), partial.size(), partialOffset);
+		partial.clear();
+	}
+
+	//whole lines from begin to end, which follows a newline, the lines without the required literal are skipped
+	void searchLines(const char* begin, const char* end) {
+		std::string const& literal = pattern.requiredLiteral();
+		for (const char* line = begin; line != end; ) {
+			const char* found = literal.empty() ? line : findLiteral(line, end - line, literal);
+			if (found == nullptr)
+				return;
+			while (found != line && found[-1] != '\n')
+				--found;
+			auto lineEnd = static_cast<const char*>(std::memchr(found, '\n', end - found)) + 1;
+			searchLine(found, lineEnd - found, offset + (found - begin));
+			line = lineEnd;
+		}
+	}
+
+	void searchLine(const char* line, std::size_t length, std::uint64_t lineOffset) {
+		if (length != 0 && line[length - 1] == '\n')
+			--length;
+		if (!pattern.matches(line, length))
+			return;
+		++piece.matchCount;
+		piece.matches += name + ":" + std::to_string(lineOffset) + ":";
+		if (std::memchr(line, '\0', length) != nullptr)
+			piece.matches += " binary data matches\n";
+		else
+			piece.matches.append(line, length).push_back('\n');
+	}
+
+	LinePattern const& pattern;
+	std::string const& name;
+	std::uint64_t offset; //of the next byte in the member
+	std::string partial; //the line open at the end of the last buffer
+	std::uint64_t partialOffset;
+	bool inHead;
+	SearchPiece& piece;
+};
@@ -1,195 +1,199 @@
 #pragma once
 #include <string>
 #include <ranges>
-#include <execution>
+#include <vector>
+#include <utility>
+#include <algorithm>
 #include <filesystem>
 #include "huffman.h"
-
-namespace fs = std::filesystem;
-
-#define BLOCK_SIZE ((1 << 10) * 750)
-
-//#define END_OF_BLOCK 255 //I assume that the 255th ASCII doesn't appear in the input text
-
-struct suffix {
-	char* ch{};
-	int index{};
-	int blockSize{};
-};
-
-struct suffixCompare {
-	bool operator() (suffix const& s1, suffix const& s2) const {
-		int blockSize = s1.blockSize;
-		int i = s1.index;
-		int j = s2.index;
-		int res = strcmp_(s1.ch + i, s2.ch + j);
-		while (--blockSize && res == 0) {
-			if ((++i) == s1.blockSize)
-				i = (i) % s1.blockSize;
-			if ((++j) == s1.blockSize)
-				j = (j) % s1.blockSize;
-			res = strcmp_(s1.ch + i, s2.ch + j);
+#include "OutputSink.h"
+
+namespace bwt {
+	constexpr int BLOCK_SIZE = (1 << 10) * 750;
+
+	//#define END_OF_BLOCK 255 //I assume that the 255th ASCII doesn't appear in the input text
+
+	//**************************************************************************************************************************
+	//BW Transform
+	char* getLastChars(const int* sortedRotations, char* originalString, int& originalStringLocation, int length) {
+		int len = length;
+		char* bwtString = new char[len];
+		for (int i{ 0 }; i < len; ++i) {
+			int j = sortedRotations[i];
+			if (j == 0) {
+				j += len;
+				originalStringLocation = i;
+			}
+			bwtString[i] = originalString[j - 1];
 		}
-		return res < 0;
-	}
-	inline int strcmp_(char* c1, char* c2) const {
-		if (*c1 == *c2) return 0;
-		if (*c1 < *c2) return -1;
-		return 1;
+		return bwtString;
 	}
-};
 
-//**************************************************************************************************************************
-//BW Transform
-char* getLastChars(suffix* sortedChars, char* originalString, int& originalStringLocation, int length) {
-	int len = length;
-	char* bwtString = new char[len];
-	for (int i{ 0 }; i < len; ++i) {
-		int j = sortedChars[i].index;
-		if (j == 0) {
-			j += len;
-			originalStringLocation = i;
+	//Sorts the rotations by prefix doubling: once the rotations are ordered by their first k characters, the
+	//rank pairs of positions i and i + k order them by their first 2k. Comparing rotations character by
+	//character instead takes time proportional to the block for every comparison on repetitive input.
+	//Characters compare as unsigned char, the order burrowsWheelerReverseTransform rebuilds the first column in.
+	char* burrowsWheelerForwardTransform(char* inputString, int length, int& originalStringLocation) {
+		std::vector<int> rotations(length), rank(length), nextRank(length);
+		auto character = [&](int i) {
+			return static_cast<int>(static_cast<unsigned char>(inputString[i % length]));
+		};
+		for (int i{ 0 }; i < length; ++i) {
+			rotations[i] = i;
+			rank[i] = (character(i) << 16) | (character(i + 1) << 8) | character(i + 2); //ranked by their first 3 characters
 		}
-		bwtString[i] = originalString[j - 1];
-	}
-	return bwtString;
-}
-
-char* burrowsWheelerForwardTransform(char* inputString, int length, int& originalStringLocation) {
-	suffix* vec = new suffix[length];
-	for (int i{ 0 }; i < length; ++i) {
-		vec[i].ch = inputString;
-		vec[i].index = i;
-		vec[i].blockSize = length;
+		for (int k{ 3 }; ; k <<= 1) {
+			auto key = [&](int i) {
+				int j = i + k;
+				return std::pair{ rank[i], rank[j < length ? j : j % length] };
+			};
+			std::sort(std::begin(rotations), std::end(rotations), [&](int a, int b) { return key(a) < key(b); });
+			int classes{ 0 };
+			for (int i{ 0 }; i < length; ++i) {
+				if (i > 0 && key(rotations[i - 1]) < key(rotations[i]))
+					++classes;
+				nextRank[rotations[i]] = classes;
+			}
+			rank.swap(nextRank);
+			if (classes == length - 1 || k >= length)
+				break;
+		}
+		return getLastChars(rotations.data(), inputString, originalStringLocation, length);
 	}
-	std::sort(std::execution::par, vec, vec + length, suffixCompare());
-	char* lastChars = getLastChars(vec, inputString, originalStringLocation, length);
-	delete[] vec;
-	return lastChars;
-}
 
 
-char* burrowsWheelerReverseTransform(char* bwtString, int length, int position) {
-	struct charLocation {
-		int indexInFirstCol{};
-		int indexInLastCol{};
-		char ch{};
-		bool operator< (charLocation const& b) const {
-			return ch < b.ch;
+	char* burrowsWheelerReverseTransform(char* bwtString, int length, int position) {
+		struct charLocation {
+			int indexInFirstCol{};
+			int indexInLastCol{};
+			unsigned char ch{};
+			bool operator< (charLocation const& b) const {
+				return ch < b.ch;
+			};
 		};
-	};
-	char* originalString = new char[length];
-	charLocation* firstColunmStr = new charLocation[length];
-	for (int i = 0; i < length; ++i) {
-		firstColunmStr[i].indexInLastCol = i;
-		firstColunmStr[i].ch = bwtString[i];
-	}
-	std::stable_sort(std::execution::par, firstColunmStr, firstColunmStr + length);
-	for (int i = 0; i < length; ++i) {
-		firstColunmStr[i].indexInFirstCol = i;
-	}
-	int* tempArray = new int[length];
-	for (int i = 0; i < length; ++i) {
-		tempArray[firstColunmStr[i].indexInLastCol] = firstColunmStr[i].indexInFirstCol;
-	}
-	int n = length - 1, i = 0, T = position;
-	originalString[n] = bwtString[T];
-	for (i = 1; i < length; ++i) {
-		originalString[--n] = bwtString[tempArray[T]];
-		T = tempArray[T];
+		char* originalString = new char[length];
+		if (length == 0) //the last block of an input that fills its blocks exactly
+			return originalString;
+		charLocation* firstColunmStr = new charLocation[length];
+		for (int i = 0; i < length; ++i) {
+			firstColunmStr[i].indexInLastCol = i;
+			firstColunmStr[i].ch = static_cast<unsigned char>(bwtString[i]);
+		}
+		std::stable_sort(firstColunmStr, firstColunmStr + length);
+		for (int i = 0; i < length; ++i) {
+			firstColunmStr[i].indexInFirstCol = i;
+		}
+		int* tempArray = new int[length];
+		for (int i = 0; i < length; ++i) {
+			tempArray[firstColunmStr[i].indexInLastCol] = firstColunmStr[i].indexInFirstCol;
+		}
+		int n = length - 1, i = 0, T = position;
+		originalString[n] = bwtString[T];
+		for (i = 1; i < length; ++i) {
+			originalString[--n] = bwtString[tempArray[T]];
+			T = tempArray[T];
+		}
+		delete[] firstColunmStr;
+		delete[] tempArray;
+		return originalString;
 	}
-	delete[] firstColunmStr;
-	delete[] tempArray;
-	return originalString;
-}
-//***************************************************************************************************************************
-
-
-
-//***************************************************************************************************************************
-//Move to front encoding
-unsigned char* mtfEncode(char* bwtString, int length) {
-	unsigned char alphabets[256];
-	for (unsigned i = 0; i < 256; ++i)
-		alphabets[i] = (unsigned char)i;
-	auto s = sizeof(int) * 2;
-	unsigned char* mtfString = new unsigned char[length + s];
-	for (unsigned i{ 0 }; i < length; ++i) {
-		for (unsigned j = 0; j < 256; ++j) {
-			if (bwtString[i] == alphabets[j]) {
-				mtfString[i + s] = (unsigned char)j;
-				unsigned char temp = alphabets[j];
-				memmove(alphabets + 1, alphabets, j);
-				alphabets[0] = temp;
-				break;
+	//***************************************************************************************************************************
+
+
+
+	//***************************************************************************************************************************
+	//Move to front encoding
+	unsigned char* mtfEncode(char* bwtString, int length) {
+		unsigned char alphabets[256];
+		for (unsigned i = 0; i < 256; ++i)
+			alphabets[i] = (unsigned char)i;
+		auto s = sizeof(int) * 2;
+		unsigned char* mtfString = new unsigned char[length + s];
+		for (int i{ 0 }; i < length; ++i) {
+			for (unsigned j = 0; j < 256; ++j) {
+				if (static_cast<unsigned char>(bwtString[i]) == alphabets[j]) {
+					mtfString[i + s] = (unsigned char)j;
+					unsigned char temp = alphabets[j];
+					memmove(alphabets + 1, alphabets, j);
+					alphabets[0] = temp;
+					break;
+				}
 			}
 		}
+		return mtfString;
 	}
-	return mtfString;
-}
 
-//move to front decoding
-char* mtfDecode(unsigned char* mtfString, int length) {
-	char alphabets[256];
-	for (unsigned i = 0; i < 256; ++i)
-		alphabets[i] = (char)i;
-	char* bwtString = new char[length];
-	unsigned index;
-	for (unsigned i{ 0 }; i < length; ++i) {
-		index = (unsigned)mtfString[i];
-		bwtString[i] = alphabets[index];
-		memmove(alphabets + 1, alphabets, index);
-		alphabets[0] = bwtString[i];
+	//move to front decoding
+	char* mtfDecode(unsigned char* mtfString, int length) {
+		char alphabets[256];
+		for (unsigned i = 0; i < 256; ++i)
+			alphabets[i] = (char)i;
+		char* bwtString = new char[length];
+		unsigned index;
+		for (int i{ 0 }; i < length; ++i) {
+			index = (unsigned)mtfString[i];
+			bwtString[i] = alphabets[index];
+			memmove(alphabets + 1, alphabets, index);
+			alphabets[0] = bwtString[i];
+		}
+		return bwtString;
+	}
+	//****************************************************************************************************************************
+
+
+
+
+	void BWCompress(std::istream& input, std::unique_ptr<stl::BitFile>& output) {
+		char* originalString = new char[BLOCK_SIZE]; //additional space for length and position
+		int length{};
+		int originalStringLocation{};
+		int extraSpace = sizeof(int) * 2;
+		do {
+			input.read(originalString, BLOCK_SIZE);
+			length = input.gcount();
+			char* bwtString = burrowsWheelerForwardTransform(originalString, length, originalStringLocation);
+			unsigned char* mtfString = mtfEncode(bwtString, length);
+			delete[] bwtString;
+			unsigned char* ptr = reinterpret_cast<unsigned char*>(&originalStringLocation);
+			unsigned char* ptr1 = reinterpret_cast<unsigned char*>(&length);
+			int i = 0;
+			mtfString[i++] = ptr[0];
+			mtfString[i++] = ptr[1];
+			mtfString[i++] = ptr[2];
+			mtfString[i++] = ptr[3];
+			mtfString[i++] = ptr1[0];
+			mtfString[i++] = ptr1[1];
+			mtfString[i++] = ptr1[2];
+			mtfString[i] = ptr1[3];
+			huffCompress(mtfString, length + extraSpace, output);
+			delete[] mtfString;
+		} while (length == BLOCK_SIZE);
+		delete[]originalString;
 	}
-	return bwtString;
-}
-//****************************************************************************************************************************
-
-
-
 
-void BWCompress(std::fstream& input, std::unique_ptr<stl::BitFile>& output) {
-	char* originalString = new char[BLOCK_SIZE]; //additional space for length and position
-	int length{};
-	int originalStringLocation{};
-	int extraSpace = sizeof(int) * 2;
-	do {
-		input.read(originalString, BLOCK_SIZE);
-		length = input.gcount();
-		char* bwtString = burrowsWheelerForwardTransform(originalString, length, originalStringLocation);
-		unsigned char* mtfString = mtfEncode(bwtString, length);
-		delete[] bwtString;
-		unsigned char* ptr = reinterpret_cast<unsigned char*>(&originalStringLocation);
-		unsigned char* ptr1 = reinterpret_cast<unsigned char*>(&length);
-		int i = 0;
-		mtfString[i++] = ptr[0];
-		mtfString[i++] = ptr[1];
-		mtfString[i++] = ptr[2];
-		mtfString[i++] = ptr[3];
-		mtfString[i++] = ptr1[0];
-		mtfString[i++] = ptr1[1];
-		mtfString[i++] = ptr1[2];
-		mtfString[i] = ptr1[3];
-		huffCompress(mtfString, length + extraSpace, output);
-		delete[] mtfString;
-	} while (length == BLOCK_SIZE);
-	delete[]originalString;
+	//A damaged block is reported as stl::FileError before its length or position is used: the length must be
+	//that of the bytes decoded and within BLOCK_SIZE, the position one of its rotations. Only the block
+	//ending an input that fills its blocks exactly is empty, and it has no position.
+	void BWExpand(std::unique_ptr<stl::BitFile>& input, OutputSink& output) {
+		int extraSpace = sizeof(int) * 2;
+		std::vector<unsigned char> block(BLOCK_SIZE + extraSpace);
+		unsigned char* mtfString = block.data();
+		int length{}; //block length
+		int originalStringLocation{};
+		do {
+			std::size_t decoded = huffExpand(input, mtfString, block.size());
+			if (decoded < static_cast<std::size_t>(extraSpace))
+				throw stl::FileError("Damaged BWT block\n");
+			originalStringLocation = *(int*)(mtfString);
+			length = *(int*)(mtfString + sizeof(int));
+			if (length < 0 || length > BLOCK_SIZE || static_cast<std::size_t>(length) != decoded - extraSpace
+				|| (length != 0 && (originalStringLocation < 0 || originalStringLocation >= length)))
+				throw stl::FileError("Damaged BWT block\n");
+			char* bwtString = mtfDecode(mtfString + extraSpace, length);
+			char* originalString = burrowsWheelerReverseTransform(bwtString, length, originalStringLocation);
+			output.write(originalString, length);
+			delete[]bwtString;
+			delete[]originalString;
+		} while (length == BLOCK_SIZE);
+	}
 }
-
-void BWExpand(std::unique_ptr<stl::BitFile>& input, std::fstream& output) {
-	int extraSpace = sizeof(int) * 2;
-	unsigned char* mtfString = new unsigned char[BLOCK_SIZE + extraSpace];
-	int length{}; //block length
-	int originalStringLocation{};
-	do {
-		huffExpand(input, mtfString);
-		originalStringLocation = *(int*)(mtfString);
-		length = *(int*)(mtfString + sizeof(int));
-		char* bwtString = mtfDecode(mtfString + extraSpace, length);
-		char* originalString = burrowsWheelerReverseTransform(bwtString, length, originalStringLocation);
-		output.write(originalString, length);
-		delete[]bwtString;
-		delete[]originalString;
-	} while (length == BLOCK_SIZE);
-	delete[]mtfString;
-}
\ No newline at end of file
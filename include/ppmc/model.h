@@ -1,210 +1,416 @@
 #pragma once
 #include "trie.h"
+#include "snapshot.h"
 #include <vector>
+#include <cstring>
+#include <algorithm>
 
-struct Symbol {
-	USHORT lowCount;
-	USHORT highCount;
-	USHORT scale;
-};
-std::uint16_t totals[SYMBOL_COUNT + 2]; //used to get the cumulative totals of any context
-std::vector<uint8_t> negativeOneContextTable(SYMBOL_COUNT);
-std::vector<std::uint8_t> excludedCharacters(SYMBOL_COUNT);
-int escapeContext = 0;
-
-
-void initializeModel(uint32_t order) {
-	escapeContext = 0;
-	trie.root = std::make_unique<Trie::Node>();
-	trie.maxDepth = order + 1;
-	basePtr = trie.root.get();//points to the most recent node of the Trie
-	cursor = basePtr;
-	std::memset(excludedCharacters.data(), 0, std::size(excludedCharacters));
-	std::memset(negativeOneContextTable.data(), 1, std::size(negativeOneContextTable));
-}
+namespace ppmc {
+	struct Symbol {
+		std::uint32_t lowCount;
+		std::uint32_t highCount;
+		std::uint32_t scale;
+	};
 
-void rescaleContextCount(Trie::Node* cursor) {
-	Trie::Node* children = cursor->downPointer;
-	for (; children; children = children->next) {
-		children->contextCount = (children->contextCount + 1) / 2;
-	}
-}
+	//PPMModel owns the context trie and everything needed to turn symbols into cumulative counts
+	//and back, so any number of models can run side by side, one per stream.
+	//The order 0 and order 1 contexts are flat FrequencyTables, they are visited on almost every escape.
+	//Only the contexts of order 2 and up live in the trie.
+	class PPMModel {
+	public:
+		explicit PPMModel(uint32_t order) : maxOrder{ static_cast<int>(order) }, negativeOneContextTable(SYMBOL_COUNT, 1),
+			excludedCharacters(SYMBOL_COUNT, 0) {
+			trie.maxDepth = order + 1;
+			if (maxOrder >= 1)
+				order1Contexts.resize(SYMBOL_COUNT - 1);
+			if (maxOrder >= 2)
+				trie.roots.resize(1 << 16);
+			startContext();
+		}
 
-void initializeTotalsToCurrentTable() {
-	totals[0] = 0;
-	int i = 0;
-	uint16_t tempArray[SYMBOL_COUNT];
-	std::memset(tempArray, 0, sizeof(tempArray));
-	if (cursor) {//context exists
-		Trie::Node* children = cursor->downPointer;
-		for (; children; children = children->next) {
-			tempArray[(int)children->symbol] = children->contextCount;
-		}
-		for (i = 0; i < (SYMBOL_COUNT - 1); i += 16) {
-			totals[i + 1] = totals[i] +
-				((excludedCharacters[i]) ? 0 : tempArray[i]);
-			totals[i + 2] = totals[i + 1] +
-				((excludedCharacters[i + 1]) ? 0 : tempArray[i + 1]);
-			totals[i + 3] = totals[i + 2] +
-				((excludedCharacters[i + 2]) ? 0 : tempArray[i + 2]);
-			totals[i + 4] = totals[i + 3] +
-				((excludedCharacters[i + 3]) ? 0 : tempArray[i + 3]);
-			totals[i + 5] = totals[i + 4] +
-				((excludedCharacters[i + 4]) ? 0 : tempArray[i + 4]);
-			totals[i + 6] = totals[i + 5] +
-				((excludedCharacters[i + 5]) ? 0 : tempArray[i + 5]);
-			totals[i + 7] = totals[i + 6] +
-				((excludedCharacters[i + 6]) ? 0 : tempArray[i + 6]);
-			totals[i + 8] = totals[i + 7] +
-				((excludedCharacters[i + 7]) ? 0 : tempArray[i + 7]);
-			totals[i + 9] = totals[i + 8] +
-				((excludedCharacters[i + 8]) ? 0 : tempArray[i + 8]);
-			totals[i + 10] = totals[i + 9] +
-				((excludedCharacters[i + 9]) ? 0 : tempArray[i + 9]);
-			totals[i + 11] = totals[i + 10] +
-				((excludedCharacters[i + 10]) ? 0 : tempArray[i + 10]);
-			totals[i + 12] = totals[i + 11] +
-				((excludedCharacters[i + 11]) ? 0 : tempArray[i + 11]);
-			totals[i + 13] = totals[i + 12] +
-				((excludedCharacters[i + 12]) ? 0 : tempArray[i + 12]);
-			totals[i + 14] = totals[i + 13] +
-				((excludedCharacters[i + 13]) ? 0 : tempArray[i + 13]);
-			totals[i + 15] = totals[i + 14] +
-				((excludedCharacters[i + 14]) ? 0 : tempArray[i + 14]);
-			totals[i + 16] = totals[i + 15] +
-				((excludedCharacters[i + 15]) ? 0 : tempArray[i + 15]);
-		}
-		totals[SYMBOL_COUNT] = totals[SYMBOL_COUNT - 1] +
-			((excludedCharacters[SYMBOL_COUNT - 1]) ? 0 : tempArray[SYMBOL_COUNT - 1]);
-		totals[SYMBOL_COUNT + 1] = totals[SYMBOL_COUNT] + cursor->noOfChildren;
-	}
-	else {//cursor is at roots vinePtr, i.e negative one context
-		for (i = 0; i < (SYMBOL_COUNT - 1); i += 16) {
-			totals[i + 1] = totals[i] +
-				((excludedCharacters[i]) ? 0 : negativeOneContextTable[i]);
-			totals[i + 2] = totals[i + 1] +
-				((excludedCharacters[i + 1]) ? 0 : negativeOneContextTable[i + 1]);
-			totals[i + 3] = totals[i + 2] +
-				((excludedCharacters[i + 2]) ? 0 : negativeOneContextTable[i + 2]);
-			totals[i + 4] = totals[i + 3] +
-				((excludedCharacters[i + 3]) ? 0 : negativeOneContextTable[i + 3]);
-			totals[i + 5] = totals[i + 4] +
-				((excludedCharacters[i + 4]) ? 0 : negativeOneContextTable[i + 4]);
-			totals[i + 6] = totals[i + 5] +
-				((excludedCharacters[i + 5]) ? 0 : negativeOneContextTable[i + 5]);
-			totals[i + 7] = totals[i + 6] +
-				((excludedCharacters[i + 6]) ? 0 : negativeOneContextTable[i + 6]);
-			totals[i + 8] = totals[i + 7] +
-				((excludedCharacters[i + 7]) ? 0 : negativeOneContextTable[i + 7]);
-			totals[i + 9] = totals[i + 8] +
-				((excludedCharacters[i + 8]) ? 0 : negativeOneContextTable[i + 8]);
-			totals[i + 10] = totals[i + 9] +
-				((excludedCharacters[i + 9]) ? 0 : negativeOneContextTable[i + 9]);
-			totals[i + 11] = totals[i + 10] +
-				((excludedCharacters[i + 10]) ? 0 : negativeOneContextTable[i + 10]);
-			totals[i + 12] = totals[i + 11] +
-				((excludedCharacters[i + 11]) ? 0 : negativeOneContextTable[i + 11]);
-			totals[i + 13] = totals[i + 12] +
-				((excludedCharacters[i + 12]) ? 0 : negativeOneContextTable[i + 12]);
-			totals[i + 14] = totals[i + 13] +
-				((excludedCharacters[i + 13]) ? 0 : negativeOneContextTable[i + 13]);
-			totals[i + 15] = totals[i + 14] +
-				((excludedCharacters[i + 14]) ? 0 : negativeOneContextTable[i + 14]);
-			totals[i + 16] = totals[i + 15] +
-				((excludedCharacters[i + 15]) ? 0 : negativeOneContextTable[i + 15]);
-		}
-		totals[SYMBOL_COUNT] = totals[SYMBOL_COUNT - 1] +
-			((excludedCharacters[SYMBOL_COUNT - 1]) ? 0 : negativeOneContextTable[SYMBOL_COUNT - 1]);
-		totals[SYMBOL_COUNT + 1] = totals[SYMBOL_COUNT] + 0;
-	}
-}
+		//starts from the statistics of a trained model instead of an empty one. The snapshot is mapped
+		//copy-on-write, so only the pages this model updates are ever copied.
+		explicit PPMModel(std::string const& snapshotPath) : snapshot{ std::make_unique<SnapshotMapping>(snapshotPath) },
+			negativeOneContextTable(SYMBOL_COUNT, 1), excludedCharacters(SYMBOL_COUNT, 0) {
+			const SnapshotHeader& header = snapshot->header();
+			maxOrder = static_cast<int>(header.order);
+			trie.maxDepth = header.order + 1;
+			order0Context = *snapshot->section<FrequencyTable>(header.order0Offset);
+			if (maxOrder >= 1) {
+				auto order1 = snapshot->section<std::uint32_t>(header.order1Offset);
+				order1Contexts.assign(order1, order1 + SYMBOL_COUNT - 1);
+			}
+			if (maxOrder >= 2) {
+				auto roots = snapshot->section<std::uint32_t>(header.rootsOffset);
+				trie.roots.assign(roots, roots + (1 << 16));
+			}
+			trie.nodes.adopt(snapshot->section<Trie::Node>(header.nodesOffset), header.nodeCount);
+			trie.wideContexts.adopt(snapshot->section<Trie::WideContext>(header.wideContextsOffset), header.wideContextCount);
+			order1Tables.adopt(snapshot->section<FrequencyTable>(header.order1TablesOffset), header.order1TableCount);
+			startContext();
+		}
 
-void getProbability() {
-	initializeTotalsToCurrentTable();
-}
+		//writes the statistics gathered so far as a flat snapshot, every PPMModel built from it starts where this one is
+		void saveSnapshot(std::string const& path, std::uint32_t dictionaryID) {
+			SnapshotWriter writer{ path };
+			SnapshotHeader header{};
+			std::memcpy(header.magic, SNAPSHOT_MAGIC, sizeof header.magic);
+			header.layout = SNAPSHOT_LAYOUT;
+			header.dictionaryID = dictionaryID;
+			header.order = maxOrder;
+			writer.write(header);
+			header.order0Offset = writer.write(order0Context);
+			if (maxOrder >= 1)
+				header.order1Offset = writer.write(order1Contexts.data(), order1Contexts.size());
+			if (maxOrder >= 2)
+				header.rootsOffset = writer.write(trie.roots.data(), trie.roots.size());
+			header.nodeCount = trie.nodes.size();
+			header.nodesOffset = writer.write(trie.nodes);
+			header.wideContextCount = trie.wideContexts.size();
+			header.wideContextsOffset = writer.write(trie.wideContexts);
+			header.order1TableCount = order1Tables.size();
+			header.order1TablesOffset = writer.write(order1Tables);
+			writer.rewriteHeader(header);
+		}
 
-void fillCharactersToBeExcluded() {
-	Trie::Node* children = cursor->downPointer;
-	for (; children; children = children->next) {
-		excludedCharacters[children->symbol] = 1;
-	}
-}
+		//the dictionary the model was loaded from, 0 for a model that started out empty
+		std::uint32_t dictionaryID() const {
+			return snapshot ? snapshot->header().dictionaryID : 0;
+		}
 
-bool convertIntToSymbol(int c, Symbol& s) {
-	bool escaped{};
-	if (escapeContext >= 0) {
-		for (; cursor; --escapeContext, cursor = cursor->vinePtr) {
-			if (cursor->noOfChildren > 0) break;
-		}
-	}
-	if (!cursor || cursor->find(c)) {//context doesn't exist, i.e cursor is at roots vinePtr
-		getProbability();
-		std::memset(excludedCharacters.data(), 0, std::size(excludedCharacters));
-		s.highCount = totals[c + 1];
-		s.lowCount = totals[c];
-		escaped = false;
-	}
-	else { //current symbol doesnt exist in context, but context exists. avoid zero probability with escape
-		getProbability();
-		fillCharactersToBeExcluded();
-		s.highCount = totals[ESCAPE + 1];
-		s.lowCount = totals[ESCAPE];
-		cursor = cursor->vinePtr;
-		--escapeContext;
-		escaped = true;
-	}
-	s.scale = totals[ESCAPE + 1];
-	return escaped;
-}
+		bool convertIntToSymbol(int c, Symbol& s) {
+			bool escaped{};
+			skipEmptyContexts();
+			if (cursorOrder < 0 || contains(c)) {//order -1 holds every symbol
+				getProbability(c, s);
+				clearExcludedCharacters();
+				escaped = false;
+			}
+			else { //current symbol doesnt exist in context, but context exists. avoid zero probability with escape
+				getProbability(ESCAPE, s);
+				fillCharactersToBeExcluded();
+				moveToShorterContext();
+				escaped = true;
+			}
+			return escaped;
+		}
 
-void getSymbolScale(Symbol& s) {
-	while (cursor) {
-		if (cursor->noOfChildren > 0)
-			break;
-		cursor = cursor->vinePtr;
-	}
-	getProbability();
-	s.scale = totals[ESCAPE + 1];
-}
+		void getSymbolScale(Symbol& s) {
+			skipEmptyContexts();
+			s.scale = availableCount() + escapeCount();
+		}
 
-int convertSymbolToInt(long index, Symbol& s) {
-	int c;
-	for (c = ESCAPE; index < totals[c]; --c) {}
-	s.highCount = totals[c + 1];
-	s.lowCount = totals[c];
-	if (c == ESCAPE) {
-		fillCharactersToBeExcluded();
-		cursor = cursor->vinePtr;
-	}
-	else {
-		std::memset(excludedCharacters.data(), 0, std::size(excludedCharacters));
-	}
-	return c;
-}
+		int convertSymbolToInt(std::uint32_t index, Symbol& s) {
+			int c;
+			std::uint32_t available = s.scale - escapeCount();
+			if (index >= available) {
+				c = ESCAPE;
+				s.lowCount = available;
+				s.highCount = s.scale;
+				fillCharactersToBeExcluded();
+				moveToShorterContext();
+			}
+			else {
+				c = findSymbol(index, s);
+				clearExcludedCharacters();
+			}
+			return c;
+		}
+
+		void updateModel(int c) {
+			std::uint32_t newBasePtr{ 0 };
+			std::uint32_t vineUpdater{ 0 };
+			if (basePtr) {
+				std::uint32_t recentlyUpdatedNodePtr{ basePtr };
+				if (trie.nodes[recentlyUpdatedNodePtr].depthInTrie == trie.maxDepth) {
+					recentlyUpdatedNodePtr = trie.nodes[recentlyUpdatedNodePtr].vine;
+				}
+				for (;;) {     //down to the order 2 root
+					auto ptr = trie.insert(recentlyUpdatedNodePtr, c);
+					if (trie.nodes[ptr].contextCount == MAX_CONTEXT_COUNT)
+						rescaleContextCount(&trie.nodes[recentlyUpdatedNodePtr]);
+					if (vineUpdater)
+						trie.nodes[vineUpdater].vine = ptr;
+					else
+						newBasePtr = ptr;
+					vineUpdater = ptr;
+					if (trie.nodes[recentlyUpdatedNodePtr].depthInTrie == 2)
+						break;
+					recentlyUpdatedNodePtr = trie.nodes[recentlyUpdatedNodePtr].vine;
+				}
+			}
+			if (historyLength > 0 && maxOrder >= 1) {
+				auto& table = order1Contexts[lastSymbol];
+				if (!table)
+					table = order1Tables.allocate();
+				if (order1Tables[table].add(c) == MAX_CONTEXT_COUNT)
+					order1Tables[table].rescale();
+			}
+			if (order0Context.add(c) == MAX_CONTEXT_COUNT)
+				order0Context.rescale();
+			//the order 2 context ending in c is where the vine of the shortest updated trie context points
+			if (historyLength > 0 && maxOrder >= 2) {
+				std::uint32_t root = trie.root(lastSymbol, c);
+				if (vineUpdater)
+					trie.nodes[vineUpdater].vine = root;
+				else
+					newBasePtr = root;
+			}
+			lastSymbol = c;
+			historyLength = std::min(historyLength + 1, 2);
+			basePtr = newBasePtr;
+			startContext();
+		}
+
+	private:
+		//the next symbol is first coded in the longest context there is
+		void startContext() {
+			cursor = trie.node(basePtr);
+			if (cursor) {
+				cursorOrder = cursor->depthInTrie;
+				frequencies = trie.frequencies(cursor);
+			}
+			else if (historyLength > 0 && maxOrder >= 1) {
+				cursorOrder = 1;
+				frequencies = order1Table(lastSymbol);
+			}
+			else {
+				cursorOrder = 0;
+				frequencies = &order0Context;
+			}
+		}
+
+		//orders 2 and up are reached through the vine pointers, below that order 1 is the table of the
+		//last symbol, then comes the order 0 table and finally order -1
+		void moveToShorterContext() {
+			--cursorOrder;
+			if (cursorOrder >= 2) {
+				cursor = trie.node(cursor->vine);
+				frequencies = trie.frequencies(cursor);
+				return;
+			}
+			cursor = nullptr;
+			if (cursorOrder == 1)
+				frequencies = order1Table(lastSymbol);
+			else if (cursorOrder == 0)
+				frequencies = &order0Context;
+			else
+				frequencies = nullptr;
+		}
+
+		bool contextIsEmpty() {
+			if (cursor)
+				return cursor->noOfChildren == 0;
+			return !frequencies || frequencies->distinct == 0;
+		}
+
+		void skipEmptyContexts() {
+			while (cursorOrder >= 0 && contextIsEmpty())
+				moveToShorterContext();
+		}
+
+		bool contains(int c) {
+			if (frequencies)
+				return frequencies->counts[c] != 0;
+			return trie.find(cursor, c) != 0;
+		}
+
+		FrequencyTable* order1Table(int previous) {
+			std::uint32_t table = order1Contexts[previous];
+			return table ? &order1Tables[table] : nullptr;
+		}
+
+		bool isExcluded(int c) {
+			return excludedCharacters[c] == exclusionGeneration;
+		}
+
+		//starting a new generation drops every exclusion at once instead of clearing the table
+		void clearExcludedCharacters() {
+			excludedList.clear();
+			excludedListSorted = true;
+			if (++exclusionGeneration == 0) {
+				std::fill(std::begin(excludedCharacters), std::end(excludedCharacters), 0);
+				exclusionGeneration = 1;
+			}
+		}
+
+		void rescaleContextCount(Trie::Node* context) {
+			context->childrenTotal = 0;
+			for (Trie::Node* children = trie.node(context->down); children; children = trie.node(children->next)) {
+				children->contextCount = (children->contextCount + 1) / 2;
+				context->childrenTotal += children->contextCount;
+			}
+			trie.recount(context);
+		}
+
+		//sum of the counts of the excluded symbols below c in the current frequency table
+		std::uint32_t excludedCountBelow(int c) {
+			std::uint32_t count = 0;
+			for (int symbol : excludedList)
+				count += (symbol < c) ? frequencies->counts[symbol] : 0;
+			return count;
+		}
+
+		//sum of the counts in the current context that are not excluded, the escape count is not included
+		std::uint32_t availableCount() {
+			std::uint32_t count = 0;
+			if (frequencies && frequencies->isSmall()) {
+				for (int i = 0; i < frequencies->distinct; ++i) {
+					int symbol = frequencies->symbols[i];
+					count += isExcluded(symbol) ? 0 : frequencies->counts[symbol];
+				}
+			}
+			else if (frequencies)
+				count = frequencies->total - excludedCountBelow(ESCAPE);
+			else if (cursor && excludedList.empty())
+				count = cursor->childrenTotal;
+			else if (cursor) {
+				for (Trie::Node* children = trie.node(cursor->down); children; children = trie.node(children->next))
+					count += isExcluded(children->symbol) ? 0 : children->contextCount;
+			}
+			else {//negative one context
+				for (int i = 0; i < SYMBOL_COUNT; ++i)
+					count += isExcluded(i) ? 0 : negativeOneContextTable[i];
+			}
+			return count;
+		}
+
+		std::uint32_t escapeCount() {
+			if (cursor)
+				return cursor->noOfChildren;
+			return frequencies ? frequencies->distinct : 0;
+		}
+
+		//the cumulative counts of c (or ESCAPE) in the current context. Counts are accumulated in symbol order
+		//over the children that exist, frequency tables take them from their Fenwick tree.
+		void getProbability(int c, Symbol& s) {
+			std::uint32_t available = availableCount(), low{ 0 }, count{ 0 };
+			if (c == ESCAPE) {
+				low = available;
+				count = escapeCount();
+			}
+			else if (frequencies && frequencies->isSmall()) {
+				for (int i = 0; frequencies->symbols[i] != c; ++i) {
+					int symbol = frequencies->symbols[i];
+					low += isExcluded(symbol) ? 0 : frequencies->counts[symbol];
+				}
+				count = frequencies->counts[c];
+			}
+			else if (frequencies) {
+				low = frequencies->countBelow(c) - excludedCountBelow(c);
+				count = frequencies->counts[c];
+			}
+			else if (cursor) {
+				Trie::Node* children = trie.node(cursor->down);
+				for (; children->symbol != c; children = trie.node(children->next))
+					low += isExcluded(children->symbol) ? 0 : children->contextCount;
+				count = children->contextCount;
+			}
+			else {
+				for (int i = 0; i < c; ++i)
+					low += isExcluded(i) ? 0 : negativeOneContextTable[i];
+				count = negativeOneContextTable[c];
+			}
+			s.lowCount = low;
+			s.highCount = low + count;
+			s.scale = available + escapeCount();
+		}
+
+		void fillCharactersToBeExcluded() {
+			auto exclude = [this](int symbol) {
+				if (!isExcluded(symbol)) {
+					excludedCharacters[symbol] = exclusionGeneration;
+					excludedList.push_back(symbol);
+				}
+			};
+			if (cursor) {
+				for (Trie::Node* children = trie.node(cursor->down); children; children = trie.node(children->next))
+					exclude(children->symbol);
+			}
+			else {
+				for (int i = 0; i < frequencies->distinct; ++i)
+					exclude(frequencies->symbols[i]);
+			}
+			excludedListSorted = false;
+		}
 
-void updateModel(int c) {
-	Trie::Node* recentlyUpdatedNodePtr{ basePtr };
-	Trie::Node* vineUpdater{ nullptr };
-	if (recentlyUpdatedNodePtr->depthInTrie == trie.maxDepth) {
-		recentlyUpdatedNodePtr = recentlyUpdatedNodePtr->vinePtr;
-	}
-	auto ptr = recentlyUpdatedNodePtr->insert(c);
-	if (ptr->contextCount == 255)
-		rescaleContextCount(recentlyUpdatedNodePtr);
-	basePtr = ptr;
-	vineUpdater = ptr;
-
-	while (recentlyUpdatedNodePtr->depthInTrie > 0) {     //while not at root
-		recentlyUpdatedNodePtr = recentlyUpdatedNodePtr->vinePtr;
-		ptr = recentlyUpdatedNodePtr->insert(c);
-		if (ptr->contextCount == 255)
-			rescaleContextCount(recentlyUpdatedNodePtr);
-		vineUpdater->vinePtr = ptr;
-		vineUpdater = ptr;
-	}
-	//at this point recentlyUpdatedNodePtr will be pointing to the root. All order 1 context symbols have their vine pointig to the root
-	ptr = recentlyUpdatedNodePtr->find(c);
-	ptr->vinePtr = recentlyUpdatedNodePtr;
-	cursor = basePtr;
-	escapeContext = basePtr->depthInTrie;
-}
\ No newline at end of file
+		//the symbol whose cumulative range holds index, the scale in s must come from getSymbolScale
+		int findSymbol(std::uint32_t index, Symbol& s) {
+			std::uint32_t low{ 0 }, count{ 0 };
+			int c{ 0 };
+			if (frequencies && frequencies->isSmall()) {
+				for (int i = 0;; ++i) {
+					c = frequencies->symbols[i];
+					if (isExcluded(c))
+						continue;
+					count = frequencies->counts[c];
+					if (low + count > index)
+						break;
+					low += count;
+				}
+			}
+			else if (frequencies) {
+				//skip the excluded symbols in ascending order, every one that ends at or below index moves the target up.
+				//Only the decoder needs them in order, so they are sorted here rather than on every escape
+				if (!excludedListSorted) {
+					std::sort(std::begin(excludedList), std::end(excludedList));
+					excludedListSorted = true;
+				}
+				std::uint32_t excluded{ 0 };
+				for (int symbol : excludedList) {
+					if (frequencies->counts[symbol] == 0)
+						continue;
+					if (frequencies->countBelow(symbol) - excluded > index)
+						break;
+					excluded += frequencies->counts[symbol];
+				}
+				c = frequencies->symbolAt(index + excluded);
+				low = frequencies->countBelow(c) - excluded;
+				count = frequencies->counts[c];
+			}
+			else if (cursor) {
+				Trie::Node* children = trie.node(cursor->down);
+				for (;; children = trie.node(children->next)) {
+					if (isExcluded(children->symbol))
+						continue;
+					count = children->contextCount;
+					if (low + count > index)
+						break;
+					low += count;
+				}
+				c = children->symbol;
+			}
+			else {
+				for (;; ++c) {
+					if (isExcluded(c))
+						continue;
+					count = negativeOneContextTable[c];
+					if (low + count > index)
+						break;
+					low += count;
+				}
+			}
+			s.lowCount = low;
+			s.highCount = low + count;
+			return c;
+		}
+
+		int maxOrder{ 0 };
+		std::unique_ptr<SnapshotMapping> snapshot; //declared before the pools that may point into it
+		Trie trie;
+		FrequencyTable order0Context;
+		Pool<FrequencyTable, 4> order1Tables;
+		std::vector<std::uint32_t> order1Contexts; //order1Tables index by the previous symbol, allocated on first use
+		std::uint32_t basePtr{ 0 }; //the longest context in the trie, 0 while there are less than two symbols of history
+		Trie::Node* cursor{ nullptr }; //trie context the next symbol is coded in, nullptr below order 2
+		FrequencyTable* frequencies{ nullptr }; //counts of the current context when it has a table, nullptr for sibling lists
+		int cursorOrder{ 0 };
+		int lastSymbol{ 0 };
+		int historyLength{ 0 };
+		std::vector<uint8_t> negativeOneContextTable;
+		std::vector<std::uint32_t> excludedCharacters; //a symbol is excluded when its stamp equals exclusionGeneration
+		std::vector<int> excludedList; //the excluded symbols, in no particular order unless excludedListSorted is set
+		bool excludedListSorted{ true };
+		std::uint32_t exclusionGeneration{ 1 };
+	};
+}
@@ -5,126 +5,147 @@
 #include <string>
 #include <bitset>
 #include "model.h"
+#include "OutputSink.h"
 
+#define RANGE_TOP (1u << 24) //the range coder renormalizes a byte at a time below this
 
-void encodeSymbol(std::unique_ptr<stl::BitFile>& output, Symbol& s, USHORT& low, USHORT& high, USHORT& underflowBits) {
-	unsigned long range = (high - low) + 1;
-	high = low + static_cast<USHORT>((range * s.highCount) / s.scale - 1);
-	low = low + static_cast<USHORT>((range * s.lowCount) / s.scale);
-	//the following loop churns out new bits until high and low are far enough apart to have stabilized
-	for (;;) {
-		//if their MSBs are the same
-		if ((high & 0x8000) == (low & 0x8000)) {
-			stl::outputBit(output, high & 0x8000);
-			while (underflowBits > 0) {
-				stl::outputBit(output, (~high) & 0x8000);
-				underflowBits--;
+namespace ppmc {
+	//PPMCoder drives a PPMModel with its own range coder state. All of the codec state lives in the
+	//object, so independent streams can be compressed or expanded concurrently, one coder per thread.
+	class PPMCoder {
+	public:
+		explicit PPMCoder(uint32_t order) : model{ order } {}
+		//encoder and decoder must start from the same snapshot
+		explicit PPMCoder(std::string const& snapshotPath) : model{ snapshotPath } {}
+
+		void compress(std::istream& input, std::unique_ptr<stl::BitFile>& output) {
+			int c{};
+			Symbol s;
+			bool escaped{};
+			for (;;) {
+				c = input.get();
+				if (c == EOF)
+					c = END_OF_STREAM;
+				escaped = model.convertIntToSymbol(c, s);
+				encodeSymbol(output, s);
+				while (escaped) {
+					escaped = model.convertIntToSymbol(c, s);
+					encodeSymbol(output, s);
+				}
+				if (c == END_OF_STREAM)
+					break;
+				model.updateModel(c);
 			}
+			flushRangeEncoder(output);
 		}
-		//if low's first and second MSBs are 01 and high's first and second MSBs are 10, and underflow is about to occur
-		else if ((low & 0x4000) && !(high & 0x4000)) {
-			underflowBits++;
-			//toggle the second MSB in both low and high.
-			high |= (1 << 14);
-			low &= ~(1 << 14);
-		}
-		else {
-			return;
+
+		void expand(std::unique_ptr<stl::BitFile>& input, OutputSink& output) {
+			Symbol s;
+			int c{};
+			std::uint32_t index{ 0 };
+			initializeRangeDecoder(input);
+			for (;;) {
+				do {
+					model.getSymbolScale(s);
+					index = getCurrentIndex(s);
+					c = model.convertSymbolToInt(index, s);
+					removeSymbolFromStream(input, s);
+				} while (c == ESCAPE);
+				if (c == END_OF_STREAM)
+					break;
+				output.put(c);
+				model.updateModel(c);
+			}
 		}
-		low <<= 1;
-		high <<= 1;
-		high |= 1;
-	}
-}
 
-void flushArithmeticEncoder(std::unique_ptr<stl::BitFile>& output, USHORT high, USHORT& underflowBits) {
-	stl::outputBit(output, high & 0x8000);
-	++underflowBits;
-	while (underflowBits > 0) {
-		stl::outputBit(output, ~high & 0x8000);
-		underflowBits--;
-	}
-}
+	private:
+		//32 bit range coder with carry propagation. low keeps a carry bit above its 32 bits, the byte
+		//that may still receive the carry waits in cache, followed by cacheSize - 1 pending 0xff bytes.
+		//The range is renormalized a byte at a time whenever it drops below RANGE_TOP.
+		void shiftLow(std::unique_ptr<stl::BitFile>& output) {
+			if (static_cast<std::uint32_t>(low) < 0xff000000 || (low >> 32) != 0) {
+				std::uint8_t carry = static_cast<std::uint8_t>(low >> 32);
+				std::uint8_t byte = cache;
+				do {
+					stl::outputByte(output, byte + carry);
+					byte = 0xff;
+				} while (--cacheSize != 0);
+				cache = static_cast<std::uint8_t>(low >> 24);
+			}
+			++cacheSize;
+			low = (low & 0x00ffffff) << 8;
+		}
 
+		void encodeSymbol(std::unique_ptr<stl::BitFile>& output, Symbol& s) {
+			std::uint32_t r = range / s.scale;
+			low += static_cast<std::uint64_t>(r) * s.lowCount;
+			range = r * (s.highCount - s.lowCount);
+			while (range < RANGE_TOP) {
+				range <<= 8;
+				shiftLow(output);
+			}
+		}
 
-inline void initializeArithmeticDecoder(std::unique_ptr<stl::BitFile>& input, USHORT& code) {
-	for (int i{ 0 }; i < 16; ++i) {
-		code <<= 1;
-		code |= stl::inputBit(input);
-	}
-}
+		void flushRangeEncoder(std::unique_ptr<stl::BitFile>& output) {
+			for (int i{ 0 }; i < 5; ++i)
+				shiftLow(output);
+		}
 
-inline long getCurrentIndex(Symbol& s, USHORT low, USHORT high, USHORT code) {
-	long range{ high - low + 1 };
-	long index = (long)(((code - low) + 1) * s.scale - 1) / range;
-	return index;
-}
+		void initializeRangeDecoder(std::unique_ptr<stl::BitFile>& input) {
+			//the first byte is the empty cache the encoder starts with
+			for (int i{ 0 }; i < 5; ++i)
+				code = (code << 8) | stl::inputByte(input);
+		}
 
-void removeSymbolFromStream(std::unique_ptr<stl::BitFile>& input, Symbol& s, USHORT& low, USHORT& high, USHORT& code) {
-	long range{ (high - low) + 1 };
-	high = low + (USHORT)((range * s.highCount) / s.scale - 1);
-	low = low + (USHORT)((range * s.lowCount) / s.scale);
-	for (;;) {
-		if ((high & 0x8000) == (low & 0x8000)) {
-			//do nothing
+		//leaves range divided by the scale, removeSymbolFromStream finishes the step
+		std::uint32_t getCurrentIndex(Symbol& s) {
+			range /= s.scale;
+			std::uint32_t index = code / range;
+			return (index < s.scale) ? index : s.scale - 1;
 		}
-		else if ((low & 0x4000) && !(high & 0x4000)) {
-			code ^= 0x4000;
-			high |= (1 << 14);//set bit
-			low &= ~(1 << 14);//clear bit
+
+		void removeSymbolFromStream(std::unique_ptr<stl::BitFile>& input, Symbol& s) {
+			code -= range * s.lowCount;
+			range *= s.highCount - s.lowCount;
+			while (range < RANGE_TOP) {
+				code = (code << 8) | stl::inputByte(input);
+				range <<= 8;
+			}
 		}
-		else
-			return;
-		low <<= 1;
-		high <<= 1;
-		high |= 1;
-		code <<= 1;
-		code |= stl::inputBit(input);
+
+		PPMModel model;
+		std::uint64_t low{ 0 };
+		std::uint32_t range{ 0xffffffff };
+		std::uint32_t code{ 0 };
+		std::uint8_t cache{ 0 };
+		std::uint64_t cacheSize{ 1 };
+	};
+
+	void compressFile(std::istream& input, std::unique_ptr<stl::BitFile>& output, uint32_t order) {
+		PPMCoder coder{ order };
+		coder.compress(input, output);
 	}
-}
 
-void compressFile(std::fstream& input, std::unique_ptr<stl::BitFile>& output, uint32_t order) {
-	int c{};
-	USHORT low{ 0 }, high{ 0xffff }, underflowBits{ 0 };
-	Symbol s;
-	initializeModel(order);
-	bool escaped{};
-	for (;;) {
-		c = input.get();
-		if (c == EOF)
-			c = END_OF_STREAM;
-		escaped = convertIntToSymbol(c, s);
-		encodeSymbol(output, s, low, high, underflowBits);
-		while (escaped) {
-			escaped = convertIntToSymbol(c, s);
-			encodeSymbol(output, s, low, high, underflowBits);
-		}
-		if (c == END_OF_STREAM)
-			break;
-		updateModel(c);
+	void expandFile(std::unique_ptr<stl::BitFile>& input, OutputSink& output, uint32_t order) {
+		PPMCoder coder{ order };
+		coder.expand(input, output);
+	}
+	void compressFile(std::istream& input, std::unique_ptr<stl::BitFile>& output, std::string const& snapshotPath) {
+		PPMCoder coder{ snapshotPath };
+		coder.compress(input, output);
 	}
-	flushArithmeticEncoder(output, high, underflowBits);
-	stl::outputBits(output, 0L, 16);
-}
 
+	void expandFile(std::unique_ptr<stl::BitFile>& input, OutputSink& output, std::string const& snapshotPath) {
+		PPMCoder coder{ snapshotPath };
+		coder.expand(input, output);
+	}
 
-void expandFile(std::unique_ptr<stl::BitFile>& input, std::fstream& output, uint32_t order) {
-	Symbol s;
-	int c{};
-	USHORT low{ 0 }, high{ 0xffff }, code{ 0 };
-	long index{ 0 };
-	initializeModel(order);
-	initializeArithmeticDecoder(input, code);
-	for (;;) {
-		do {
-			getSymbolScale(s);
-			index = getCurrentIndex(s, low, high, code);
-			c = convertSymbolToInt(index, s);
-			removeSymbolFromStream(input, s, low, high, code);
-		} while (c == ESCAPE);
-		if (c == END_OF_STREAM)
-			break;
-		output.put(c);
-		updateModel(c);
+	//builds a model of the given order from sample data and saves it as a snapshot. Small inputs like the
+	//sample compress far better when their model starts out knowing its statistics.
+	void trainSnapshot(std::istream& sample, std::string const& snapshotPath, uint32_t order, std::uint32_t dictionaryID) {
+		PPMModel model{ order };
+		for (int c = sample.get(); c != EOF; c = sample.get())
+			model.updateModel(c);
+		model.saveSnapshot(snapshotPath, dictionaryID);
 	}
-}
\ No newline at end of file
+}
@@ -0,0 +1,170 @@
+#pragma once
+#include <algorithm>
+#include <cstring>
+#include <string>
+#include "..\MappedFile.h"
+#include "trie.h"
+
+#define SNAPSHOT_MAGIC "QPPM"
+#define SNAPSHOT_LAYOUT 1 //bumped whenever the layout of the snapshot or of the structures in it changes
+#define SNAPSHOT_ALIGNMENT 64
+
+namespace ppmc {
+	//A model snapshot is the memory image of a trained PPMModel: the header, the order 0 table, the order 1
+	//and order 2 index arrays, then the node, wide context and order 1 table pools. Everything refers to
+	//everything else by pool index, so the file holds no pointers and can be mapped back in at any address.
+	//The structures are stored in the layout of the machine that wrote them, the sizes in the header guard
+	//against loading a snapshot written by an incompatible build.
+	struct SnapshotHeader {
+		char magic[4];
+		std::uint32_t layout;
+		std::uint32_t nodeSize{ sizeof(Trie::Node) };
+		std::uint32_t wideContextSize{ sizeof(Trie::WideContext) };
+		std::uint32_t tableSize{ sizeof(FrequencyTable) };
+		std::uint32_t dictionaryID;
+		std::uint32_t order;
+		std::uint32_t nodeCount;
+		std::uint32_t wideContextCount;
+		std::uint32_t order1TableCount;
+		std::uint64_t order0Offset;
+		std::uint64_t order1Offset;
+		std::uint64_t rootsOffset;
+		std::uint64_t nodesOffset;
+		std::uint64_t wideContextsOffset;
+		std::uint64_t order1TablesOffset;
+	};
+
+
+	//Maps a snapshot file copy-on-write. The pages are shared with the page cache until a model writes to them.
+	class SnapshotMapping {
+	public:
+		explicit SnapshotMapping(std::string const& path) : file{ path, MappedFile::Access::CopyOnWrite } {
+			validate(path);
+		}
+
+		const SnapshotHeader& header() const {
+			return *reinterpret_cast<const SnapshotHeader*>(file.data());
+		}
+		template <typename T>
+		T* section(std::uint64_t offset) const {
+			return reinterpret_cast<T*>(file.data() + offset);
+		}
+
+	private:
+		void validate(std::string const& path) const {
+			const SnapshotHeader& h = header();
+			SnapshotHeader expected{};
+			bool valid = file.size() >= sizeof(SnapshotHeader) && std::memcmp(h.magic, SNAPSHOT_MAGIC, sizeof h.magic) == 0
+				&& h.layout == SNAPSHOT_LAYOUT && h.nodeSize == expected.nodeSize
+				&& h.wideContextSize == expected.wideContextSize && h.tableSize == expected.tableSize;
+			valid = valid && fits(h.order0Offset, 1, sizeof(FrequencyTable))
+				&& (h.order < 1 || fits(h.order1Offset, SYMBOL_COUNT - 1, sizeof(std::uint32_t)))
+				&& (h.order < 2 || fits(h.rootsOffset, 1 << 16, sizeof(std::uint32_t)))
+				&& fits(h.nodesOffset, h.nodeCount, sizeof(Trie::Node))
+				&& fits(h.wideContextsOffset, h.wideContextCount, sizeof(Trie::WideContext))
+				&& fits(h.order1TablesOffset, h.order1TableCount, sizeof(FrequencyTable));
+			if (!valid || !indicesFit())
+				throw stl::FileError("Not a usable model snapshot: " + path);
+		}
+		//Every index in the pools must name an entry of its pool and every symbol a symbol, or a damaged
+		//snapshot would have the model read and write outside the mapping. This reads the whole file once.
+		bool indicesFit() const {
+			const SnapshotHeader& h = header();
+			if (!symbolsFit(*section<FrequencyTable>(h.order0Offset)))
+				return false;
+			if (h.order >= 1 && !allBelow(section<std::uint32_t>(h.order1Offset), SYMBOL_COUNT - 1, h.order1TableCount))
+				return false;
+			if (h.order >= 2 && !allBelow(section<std::uint32_t>(h.rootsOffset), 1 << 16, h.nodeCount))
+				return false;
+			auto nodes = section<Trie::Node>(h.nodesOffset);
+			for (std::uint32_t i = 0; i < h.nodeCount; ++i) {
+				if (nodes[i].down >= h.nodeCount || nodes[i].next >= h.nodeCount || nodes[i].vine >= h.nodeCount
+					|| nodes[i].wide >= h.wideContextCount || nodes[i].symbol >= SYMBOL_COUNT)
+					return false;
+			}
+			auto wideContexts = section<Trie::WideContext>(h.wideContextsOffset);
+			for (std::uint32_t i = 0; i < h.wideContextCount; ++i) {
+				if (!allBelow(wideContexts[i].children, SYMBOL_COUNT, h.nodeCount) || !symbolsFit(wideContexts[i].frequencies))
+					return false;
+			}
+			auto tables = section<FrequencyTable>(h.order1TablesOffset);
+			return std::all_of(tables, tables + h.order1TableCount, [](FrequencyTable const& table) { return symbolsFit(table); });
+		}
+		static bool allBelow(const std::uint32_t* indices, std::size_t count, std::uint32_t limit) {
+			return std::all_of(indices, indices + count, [limit](std::uint32_t index) { return index < limit; });
+		}
+		//The listed symbols must be those with a count, in ascending order, and the total and, once the table
+		//is not small, the Fenwick tree those of the counts, or symbolAt could walk past the last symbol.
+		static bool symbolsFit(FrequencyTable const& table) {
+			if (table.distinct > SYMBOL_COUNT)
+				return false;
+			std::uint32_t total{ 0 };
+			int listed{ 0 };
+			for (int symbol = 0; symbol < SYMBOL_COUNT; ++symbol) {
+				if (table.counts[symbol] == 0)
+					continue;
+				if (listed == table.distinct || table.symbols[listed++] != symbol)
+					return false;
+				total += table.counts[symbol];
+			}
+			if (listed != table.distinct || total != table.total)
+				return false;
+			if (table.isSmall())
+				return true;
+			FrequencyTable rebuilt = table;
+			rebuilt.buildTree();
+			return std::equal(std::begin(table.tree), std::end(table.tree), std::begin(rebuilt.tree));
+		}
+		bool fits(std::uint64_t offset, std::uint64_t count, std::uint64_t size) const {
+			return offset % SNAPSHOT_ALIGNMENT == 0 && offset <= file.size() && count * size <= file.size() - offset;
+		}
+
+		MappedFile file;
+	};
+
+
+	//Writes the sections of a snapshot one after another, each one aligned to SNAPSHOT_ALIGNMENT.
+	//The header goes first and is rewritten once the offsets of the sections are known.
+	class SnapshotWriter {
+	public:
+		explicit SnapshotWriter(std::string const& path) : file{ path, std::ios_base::out | std::ios_base::binary } {
+			if (!file.is_open())
+				throw stl::FileError("Can't create model snapshot " + path);
+		}
+		template <typename T>
+		std::uint64_t write(const T* entries, std::size_t count) {
+			std::uint64_t offset = align();
+			file.write(reinterpret_cast<const char*>(entries), count * sizeof(T));
+			return offset;
+		}
+		template <typename T>
+		std::uint64_t write(T const& entry) {
+			return write(&entry, 1);
+		}
+		//the pool is written with its indices unchanged, the unused gap after adopted entries is zero filled
+		template <typename T, int ChunkShift>
+		std::uint64_t write(Pool<T, ChunkShift>& pool) {
+			std::uint64_t offset = align();
+			T empty{};
+			for (std::uint32_t i = 0; i < pool.size(); ++i)
+				file.write(reinterpret_cast<const char*>(pool.isValid(i) ? &pool[i] : &empty), sizeof(T));
+			return offset;
+		}
+		void rewriteHeader(SnapshotHeader const& header) {
+			file.seekp(0);
+			file.write(reinterpret_cast<const char*>(&header), sizeof header);
+			if (!file.flush())
+				throw stl::FileError("An error occurred writing the model snapshot\n");
+		}
+
+	private:
+		std::uint64_t align() {
+			std::uint64_t offset = file.tellp();
+			for (; offset % SNAPSHOT_ALIGNMENT != 0; ++offset)
+				file.put(0);
+			return offset;
+		}
+
+		std::ofstream file;
+	};
+}
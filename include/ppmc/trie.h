@@ -2,71 +2,254 @@
 #include <memory>
 #include <iostream>
 #include <stdexcept>
+#include <algorithm>
+#include <vector>
 
-#define ESCAPE 257
-#define END_OF_STREAM 256
-#define SYMBOL_COUNT 257 //ascii 256 symbols + EOF symbol
-#define MAX_SIZE  ((1 << 14) - (1))
+namespace ppmc {
+	constexpr int ESCAPE = 257;
+	constexpr int END_OF_STREAM = 256;
+	constexpr int SYMBOL_COUNT = 257; //ascii 256 symbols + EOF symbol
+	constexpr int MAX_SIZE = (1 << 14) - 1;
+	constexpr int MAX_CONTEXT_COUNT = 0x3ff; //a context is rescaled when one of its counts reaches this
+	constexpr int CHILD_INDEX_THRESHOLD = 16; //contexts with more children than this get a direct symbol->child index
 
-using USHORT = std::uint16_t;
+	using USHORT = std::uint16_t;
 
 
-struct Trie {
-	struct Node {
-		Node* downPointer; //pointer to the first child
-		Node* next; //next sibling of this node under the same parent
-		Node* prev; //next sibling of this node under the same parent
-		Node* vinePtr;
-		int symbol;
-		std::uint8_t contextCount;
-		std::uint8_t depthInTrie;
-		std::uint8_t noOfChildren;
-		Node() : downPointer{ nullptr }, next{ nullptr }, prev{ nullptr }, vinePtr{ nullptr }, symbol{ char() }, contextCount{ 0 },
-			depthInTrie{ 0 }, noOfChildren{ 0 } {}
-		Node* find(int index) {
-			Node* cursor = downPointer;
-			while (cursor && cursor->symbol != index) {
-				cursor = cursor->next;
+	//Flat frequency table of one context. The counts are kept in a Fenwick tree, so cumulative counts are
+	//updated incrementally and a cumulative count can be mapped back to its symbol in log(SYMBOL_COUNT) steps.
+	//The order 0 and order 1 contexts are held in these tables, so are the trie contexts with a high fanout.
+	struct FrequencyTable {
+		std::uint16_t counts[SYMBOL_COUNT]{};
+		std::uint32_t tree[SYMBOL_COUNT + 1]{}; //only maintained once the table is no longer small
+		std::uint16_t symbols[SYMBOL_COUNT]{}; //the symbols with a non zero count, in ascending order
+		std::uint32_t total{ 0 };
+		std::uint16_t distinct{ 0 };
+
+		std::uint16_t add(int symbol, std::uint16_t count = 1) {
+			bool grew = (counts[symbol] == 0);
+			if (grew) {
+				int i = distinct++;
+				for (; i > 0 && symbols[i - 1] > symbol; --i)
+					symbols[i] = symbols[i - 1];
+				symbols[i] = symbol;
 			}
-			return cursor;
-		}
-		Node* insert(int symbol) {
-			if (noOfChildren == 0) {
-				downPointer = new Node();
-				downPointer->symbol = symbol;
-				downPointer->depthInTrie = depthInTrie + 1;
-				downPointer->contextCount++;
-				++noOfChildren;
-				return downPointer;
+			counts[symbol] += count;
+			total += count;
+			if (grew && distinct == CHILD_INDEX_THRESHOLD + 1)
+				buildTree();
+			else if (!isSmall()) {
+				for (int i = symbol + 1; i <= SYMBOL_COUNT; i += i & -i)
+					tree[i] += count;
 			}
-			else {
-				Node* cursor = downPointer;
-				while (cursor->symbol != symbol && cursor->next) {
-					cursor = cursor->next;
-				}
-				if (cursor->symbol == symbol) {
-					cursor->contextCount++;
-				}
-				else {
-					cursor->next = new Node;
-					cursor->next->symbol = symbol;
-					cursor->next->depthInTrie = depthInTrie + 1;
-					cursor->next->contextCount++;
-					cursor->next->prev = cursor;
-					cursor = cursor->next;
-					++noOfChildren;
+			return counts[symbol];
+		}
+		//while a table holds few symbols it is cheaper to walk symbols[] than to query the Fenwick tree
+		bool isSmall() const {
+			return distinct <= CHILD_INDEX_THRESHOLD;
+		}
+		void buildTree() {
+			std::fill(std::begin(tree), std::end(tree), 0);
+			for (int i = 0; i < distinct; ++i) {
+				for (int j = symbols[i] + 1; j <= SYMBOL_COUNT; j += j & -j)
+					tree[j] += counts[symbols[i]];
+			}
+		}
+		//sum of the counts of all symbols below symbol
+		std::uint32_t countBelow(int symbol) const {
+			std::uint32_t count = 0;
+			for (int i = symbol; i > 0; i -= i & -i)
+				count += tree[i];
+			return count;
+		}
+		//the symbol whose cumulative range holds target, i.e the largest symbol with countBelow(symbol) <= target
+		int symbolAt(std::uint32_t target) const {
+			int position = 0;
+			for (int step = 256; step > 0; step >>= 1) {
+				if (position + step <= SYMBOL_COUNT && tree[position + step] <= target) {
+					position += step;
+					target -= tree[position];
 				}
-				return cursor;
 			}
+			return position;
 		}
-		~Node() {
-			if (downPointer) delete downPointer;
-			if (next) delete next;
+		void clear() {
+			for (int i = 0; i < distinct; ++i)
+				counts[symbols[i]] = 0;
+			total = 0;
+			distinct = 0;
+		}
+		void rescale() {
+			int present = distinct;
+			for (int i = 0; i < present; ++i)
+				counts[symbols[i]] = (counts[symbols[i]] + 1) / 2;
+			total = 0;
+			for (int i = 0; i < present; ++i)
+				total += counts[symbols[i]];
+			if (!isSmall())
+				buildTree();
 		}
 	};
-	std::unique_ptr<Node> root;
-	uint8_t maxDepth{ 0 };
-} trie;
 
-Trie::Node* basePtr;//points to the most recent node of the Trie
-Trie::Node* cursor;
\ No newline at end of file
+
+	//Chunked storage for trie nodes and tables, entries are addressed by a 32 bit index and index 0 stands for none.
+	//Chunks never move, so references to entries stay valid while the pool grows. The leading chunks can be
+	//adopted from a mapped model snapshot, in which case new entries continue on the next chunk boundary.
+	template <typename T, int ChunkShift>
+	class Pool {
+	public:
+		static constexpr std::uint32_t CHUNK_SIZE = 1u << ChunkShift;
+		static constexpr std::uint32_t CHUNK_MASK = CHUNK_SIZE - 1;
+
+		Pool() {
+			allocate(); //reserve index 0
+		}
+		T& operator[](std::uint32_t index) {
+			return chunks[index >> ChunkShift][index & CHUNK_MASK];
+		}
+		std::uint32_t allocate() {
+			if ((count & CHUNK_MASK) == 0) {
+				owned.push_back(std::make_unique<T[]>(CHUNK_SIZE));
+				chunks.push_back(owned.back().get());
+			}
+			return count++;
+		}
+		//takes over entries [0, size) without copying them, the memory must outlive the pool
+		void adopt(T* entries, std::uint32_t size) {
+			chunks.clear();
+			owned.clear();
+			for (std::uint32_t i = 0; i < size; i += CHUNK_SIZE)
+				chunks.push_back(entries + i);
+			adoptedSize = size;
+			count = static_cast<std::uint32_t>(chunks.size()) << ChunkShift;
+		}
+		//indices between the adopted entries and the next chunk boundary are never handed out
+		bool isValid(std::uint32_t index) const {
+			return index < adoptedSize || index >= ((adoptedSize + CHUNK_MASK) & ~CHUNK_MASK);
+		}
+		std::uint32_t size() const {
+			return count;
+		}
+
+	private:
+		std::vector<T*> chunks;
+		std::vector<std::unique_ptr<T[]>> owned;
+		std::uint32_t count{ 0 };
+		std::uint32_t adoptedSize{ 0 };
+	};
+
+
+	//The trie holds the contexts of order 2 and up. Every order 2 context is a root, found directly
+	//from its two symbols, nodes below it are the longer contexts. Nodes refer to each other by pool
+	//index rather than by pointer, so the whole trie can be written out and mapped back in as is.
+	struct Trie {
+		struct Node {
+			std::uint32_t down; //first child, siblings are kept in ascending symbol order
+			std::uint32_t next; //next sibling of this node under the same parent
+			std::uint32_t vine; //the same context one order shorter
+			std::uint32_t wide; //WideContext of a high fanout context, 0 while the sibling list is short
+			std::uint32_t childrenTotal; //sum of the counts of the children
+			std::uint16_t symbol;
+			std::uint16_t contextCount;
+			std::uint16_t noOfChildren;
+			std::uint8_t depthInTrie;
+		};
+		//walking the sibling list for every coded symbol is too slow in contexts with many children,
+		//so once a context passes CHILD_INDEX_THRESHOLD children they are indexed directly by symbol
+		//and their cumulative counts are kept in a FrequencyTable.
+		struct WideContext {
+			std::uint32_t children[SYMBOL_COUNT];
+			FrequencyTable frequencies;
+		};
+
+		Pool<Node, 12> nodes;
+		Pool<WideContext, 4> wideContexts;
+		std::vector<std::uint32_t> roots; //the order 2 contexts, indexed by (previous symbol << 8) | symbol
+		uint8_t maxDepth{ 0 };
+
+		Node* node(std::uint32_t index) {
+			return index ? &nodes[index] : nullptr;
+		}
+		FrequencyTable* frequencies(Node* context) {
+			return context->wide ? &wideContexts[context->wide].frequencies : nullptr;
+		}
+		std::uint32_t find(Node* context, int symbol) {
+			if (context->wide)
+				return wideContexts[context->wide].children[symbol];
+			std::uint32_t child = context->down;
+			while (child && nodes[child].symbol != symbol)
+				child = nodes[child].next;
+			return child;
+		}
+		void buildChildIndex(Node* context) {
+			std::uint32_t wide = wideContexts.allocate();
+			context->wide = wide;
+			for (std::uint32_t child = context->down; child; child = nodes[child].next)
+				wideContexts[wide].children[nodes[child].symbol] = child;
+			recount(context);
+		}
+		//refills the frequency table after the children counts were rescaled
+		void recount(Node* context) {
+			if (!context->wide)
+				return;
+			FrequencyTable& table = wideContexts[context->wide].frequencies;
+			table.clear();
+			for (std::uint32_t child = context->down; child; child = nodes[child].next)
+				table.add(nodes[child].symbol, nodes[child].contextCount);
+		}
+		std::uint32_t precedingChild(Node* context, int symbol) {
+			if (context->wide) {
+				std::uint32_t* children = wideContexts[context->wide].children;
+				while (--symbol >= 0) {
+					if (children[symbol])
+						return children[symbol];
+				}
+				return 0;
+			}
+			std::uint32_t child = context->down;
+			if (!child || nodes[child].symbol > symbol)
+				return 0;
+			while (nodes[child].next && nodes[nodes[child].next].symbol < symbol)
+				child = nodes[child].next;
+			return child;
+		}
+		//counts symbol in the context given by its index and returns the index of the child that holds it
+		std::uint32_t insert(std::uint32_t contextIndex, int symbol) {
+			Node* context = &nodes[contextIndex];
+			std::uint32_t child = find(context, symbol);
+			if (context->wide)
+				wideContexts[context->wide].frequencies.add(symbol);
+			++context->childrenTotal;
+			if (child) {
+				nodes[child].contextCount++;
+				return child;
+			}
+			std::uint32_t before = precedingChild(context, symbol);
+			child = nodes.allocate();
+			Node& created = nodes[child];
+			created.symbol = symbol;
+			created.depthInTrie = context->depthInTrie + 1;
+			created.contextCount = 1;
+			created.next = before ? nodes[before].next : context->down;
+			if (before)
+				nodes[before].next = child;
+			else
+				context->down = child;
+			++context->noOfChildren;
+			if (context->wide)
+				wideContexts[context->wide].children[symbol] = child;
+			else if (context->noOfChildren > CHILD_INDEX_THRESHOLD)
+				buildChildIndex(context);
+			return child;
+		}
+		std::uint32_t root(int previous, int symbol) {
+			auto& index = roots[(previous << 8) | symbol];
+			if (!index) {
+				index = nodes.allocate();
+				nodes[index].symbol = symbol;
+				nodes[index].depthInTrie = 2;
+			}
+			return index;
+		}
+	};
+}
@@ -15,75 +15,105 @@
 #include <fstream>
 #include <filesystem>
 #include <algorithm>
+#include <sstream>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <unordered_set>
+#include <unordered_map>
+#include <deque>
+#include <chrono>
+#include <span>
+#include <array>
+#include <functional>
+#include <exception>
+#include <optional>
+#if defined (_WIN32)
+#include <io.h>
+#include <fcntl.h>
+#endif
 #include "Error.h"
+#include "CRC32.h"
+#include "MethodSelection.h"
+#include "ArchiveDirectory.h"
+#include "FileCopy.h"
+#include "Dedup.h"
+#include "PositionalFile.h"
+#include "OutputSink.h"
+#include "Search.h"
+#include "FileWalker.h"
+#include "BoundedQueue.h"
 //#define NDEBUG 
 #include <cassert>
 
 namespace fs = std::filesystem;
 
-#define BASE_HEADER_SIZE 19
-#define CRC_MASK 0xFFFFFFFFL
-#define CRC32_POLYNOMIAL 0xEDB88320L //CRC-32 Adler
+#define BASE_HEADER_SIZE 23
+#define MEMBER_CHUNK_SIZE (8 << 20) //source bytes per chunk, every chunk is coded on its own
+#define CHUNK_HEADER_SIZE 9 //method, source size and coded size of a chunk
+#define PIPELINE_CHUNKS 3 //chunks a member being added holds at once: one read ahead, one being coded and one being written
 
 #define FILENAME_MAX_LENGTH 128
-#define MAX_FILE_LIST 100 //number of files that can be processed at a time
+#define EXPANSION_LIMIT_PERCENT 1 //output may exceed the input read so far by this much before compression gives up
+#define DEAD_MEMBER_METHOD 0x7f //method a member's header is rewritten with once it is replaced or deleted
+#define SOLID_MEMBER_METHOD 0x7e //a member held in a solid block, its data is a SOLID_RECORD_SIZE reference to it
+#define SOLID_RECORD_SIZE 16 //header offset of the block and offset of the member within the expanded block
+#define SOLID_BLOCK_PREFIX "/solid/" //names of the solid blocks, no member name taken from a path contains a /
+#define MAX_SOLID_BLOCK_MB 2048 //a block is coded as one chunk, whose size must fit the chunk header
+#define DEDUP_MEMBER_METHOD 0x7d //a member made of chunks kept in solid blocks, its data is a list of extents in them
+#define DEDUP_EXTENT_SIZE 20 //header offset of a block, offset within the expanded block and length
+#define FRAME_TABLE_CHUNK 0x7c //method of the chunk header of source size 0 that ends the frames of a framed member
+#define FRAME_RECORD_SIZE 20 //source offset, chunk position within the member data and CRC of a frame
+#define FRAME_TABLE_MAGIC "QAF1" //ends the data of a framed member, after the number of frames
+#define MAX_FRAME_KB (1 << 21) //a frame is a chunk, whose size must fit the chunk header
+#define STREAM_MAGIC "QAS1" //starts what -z writes, a member without a header so it can go through pipes
+#define EXPANDED_CHUNK_CACHE 4 //expanded chunks of solid blocks kept while members are read out of them
+#define MAX_PENDING_MEMBERS 64 //members extraction may run ahead of the one being reported
+#define MAX_QUEUED_FILES 4096 //files the parallel -a may list ahead of the member being written
 
 struct Header {
 	char filename[FILENAME_MAX_LENGTH];
-	std::uint32_t originalSize{};
-	std::uint32_t compressedSize{};
+	std::uint64_t originalSize{};
+	std::uint64_t compressedSize{};
 	std::uint32_t originalCRC{};
 	std::uint32_t headerCRC{};
+	std::uint32_t dictionaryID{}; //the PPMC model snapshot the member was compressed with, 0 for none, the only value quanta writes
 	char compressionMethod{};
+	std::int64_t modified{}; //kept in the central directory only, as is contentHash
+	std::uint64_t contentHash{};
 };
 
 //global variables
 char tempFileName[FILENAME_MAX_LENGTH];
 char carFileName[FILENAME_MAX_LENGTH];
-std::vector<std::string> fileList(MAX_FILE_LIST);
+std::vector<std::string> fileList;
 std::fstream inputCarFile;
 std::fstream outputCarFile;
 Header header;
-
-std::uint32_t ccitt32Table[256] = { 0x00000000,0x77073096,0xee0e612c,0x990951ba,0x076dc419,0x706af48f,0xe963a535,0x9e6495a3,
-		0x0edb8832,0x79dcb8a4,0xe0d5e91e,0x97d2d988,0x09b64c2b,0x7eb17cbd,0xe7b82d07,0x90bf1d91,
-		0x1db71064,0x6ab020f2,0xf3b97148,0x84be41de,0x1adad47d,0x6ddde4eb,0xf4d4b551,0x83d385c7,
-		0x136c9856,0x646ba8c0,0xfd62f97a,0x8a65c9ec,0x14015c4f,0x63066cd9,0xfa0f3d63,0x8d080df5,
-		0x3b6e20c8,0x4c69105e,0xd56041e4,0xa2677172,0x3c03e4d1,0x4b04d447,0xd20d85fd,0xa50ab56b,
-		0x35b5a8fa,0x42b2986c,0xdbbbc9d6,0xacbcf940,0x32d86ce3,0x45df5c75,0xdcd60dcf,0xabd13d59,
-		0x26d930ac,0x51de003a,0xc8d75180,0xbfd06116,0x21b4f4b5,0x56b3c423,0xcfba9599,0xb8bda50f,
-		0x2802b89e,0x5f058808,0xc60cd9b2,0xb10be924,0x2f6f7c87,0x58684c11,0xc1611dab,0xb6662d3d,
-		0x76dc4190,0x01db7106,0x98d220bc,0xefd5102a,0x71b18589,0x06b6b51f,0x9fbfe4a5,0xe8b8d433,
-		0x7807c9a2,0x0f00f934,0x9609a88e,0xe10e9818,0x7f6a0dbb,0x086d3d2d,0x91646c97,0xe6635c01,
-		0x6b6b51f4,0x1c6c6162,0x856530d8,0xf262004e,0x6c0695ed,0x1b01a57b,0x8208f4c1,0xf50fc457,
-		0x65b0d9c6,0x12b7e950,0x8bbeb8ea,0xfcb9887c,0x62dd1ddf,0x15da2d49,0x8cd37cf3,0xfbd44c65,
-		0x4db26158,0x3ab551ce,0xa3bc0074,0xd4bb30e2,0x4adfa541,0x3dd895d7,0xa4d1c46d,0xd3d6f4fb,
-		0x4369e96a,0x346ed9fc,0xad678846,0xda60b8d0,0x44042d73,0x33031de5,0xaa0a4c5f,0xdd0d7cc9,
-		0x5005713c,0x270241aa,0xbe0b1010,0xc90c2086,0x5768b525,0x206f85b3,0xb966d409,0xce61e49f,
-		0x5edef90e,0x29d9c998,0xb0d09822,0xc7d7a8b4,0x59b33d17,0x2eb40d81,0xb7bd5c3b,0xc0ba6cad,
-		0xedb88320,0x9abfb3b6,0x03b6e20c,0x74b1d29a,0xead54739,0x9dd277af,0x04db2615,0x73dc1683,
-		0xe3630b12,0x94643b84,0x0d6d6a3e,0x7a6a5aa8,0xe40ecf0b,0x9309ff9d,0x0a00ae27,0x7d079eb1,
-		0xf00f9344,0x8708a3d2,0x1e01f268,0x6906c2fe,0xf762575d,0x806567cb,0x196c3671,0x6e6b06e7,
-		0xfed41b76,0x89d32be0,0x10da7a5a,0x67dd4acc,0xf9b9df6f,0x8ebeeff9,0x17b7be43,0x60b08ed5,
-		0xd6d6a3e8,0xa1d1937e,0x38d8c2c4,0x4fdff252,0xd1bb67f1,0xa6bc5767,0x3fb506dd,0x48b2364b,
-		0xd80d2bda,0xaf0a1b4c,0x36034af6,0x41047a60,0xdf60efc3,0xa867df55,0x316e8eef,0x4669be79,
-		0xcb61b38c,0xbc66831a,0x256fd2a0,0x5268e236,0xcc0c7795,0xbb0b4703,0x220216b9,0x5505262f,
-		0xc5ba3bbe,0xb2bd0b28,0x2bb45a92,0x5cb36a04,0xc2d7ffa7,0xb5d0cf31,0x2cd99e8b,0x5bdeae1d,
-		0x9b64c2b0,0xec63f226,0x756aa39c,0x026d930a,0x9c0906a9,0xeb0e363f,0x72076785,0x05005713,
-		0x95bf4a82,0xe2b87a14,0x7bb12bae,0x0cb61b38,0x92d28e9b,0xe5d5be0d,0x7cdcefb7,0x0bdbdf21,
-		0x86d3d2d4,0xf1d4e242,0x68ddb3f8,0x1fda836e,0x81be16cd,0xf6b9265b,0x6fb077e1,0x18b74777,
-		0x88085ae6,0xff0f6a70,0x66063bca,0x11010b5c,0x8f659eff,0xf862ae69,0x616bffd3,0x166ccf45,
-		0xa00ae278,0xd70dd2ee,0x4e048354,0x3903b3c2,0xa7672661,0xd06016f7,0x4969474d,0x3e6e77db,
-		0xaed16a4a,0xd9d65adc,0x40df0b66,0x37d83bf0,0xa9bcae53,0xdebb9ec5,0x47b2cf7f,0x30b5ffe9,
-		0xbdbdf21c,0xcabac28a,0x53b39330,0x24b4a3a6,0xbad03605,0xcdd70693,0x54de5729,0x23d967bf,
-		0xb3667a2e,0xc4614ab8,0x5d681b02,0x2a6f2b94,0xb40bbe37,0xc30c8ea1,0x5a05df1b,0x2d02ef8d
-};
+std::unique_ptr<ArchiveDirectory> inputDirectory; //nullptr for archives written before the central directory
+std::vector<DirectoryEntry> outputDirectory; //the members written to outputCarFile so far
+std::vector<DirectoryEntry> deadMembers; //members replaced or deleted in place, marked dead once the new directory is out
+std::uint64_t membersEnd{ 0 }; //where the member data of the input archive ends and appended members go
+std::optional<std::string> archiveTail; //the bytes of the archive past membersEnd before an update, none if it created the archive
+unsigned workerCount{ std::max(1u, std::thread::hardware_concurrency()) };
+std::uint64_t memoryCap{ 256ull << 20 }; //compressed bytes the parallel -a may hold in memory
+unsigned selectionEffort{ 2 }; //how hard -a works at picking the compression method of each file, see selectMethod
+unsigned compactThreshold{ 25 }; //percentage of dead bytes above which -c rewrites the archive
+std::uint64_t solidBlockSize{ 0 }; //-a groups files smaller than this into solid blocks, 0 adds every file on its own
+std::size_t dedupChunkSize{ 0 }; //average size of the content defined chunks -a stores once each, 0 for none
+std::string searchPattern; //the lines -g prints match this, see LinePattern
+std::size_t frameSize{ MEMBER_CHUNK_SIZE }; //source bytes per chunk of the files -a adds
+bool frameTables{ false }; //-f: the files -a adds end in a table of their chunks, which makes them seekable
+std::uint64_t rangeOffset{ 0 }; //where the bytes -b writes start in the member
+std::uint64_t rangeLength{ 0 };
 
 int parseArguments(int argc, char* argv[]) {
 	int command{};
 	if (argc == 1) { //user entered command without specifying command...print usage
 		usage();
 	}
+	if (argc == 2 && strlen(argv[1]) == 2 && (toupper(argv[1][1]) == 'Z' || toupper(argv[1][1]) == 'U'))
+		return toupper(argv[1][1]); //the streams are the data, nothing else may go to standard output
 	if (argc < 3 || strlen(argv[1]) != 2 || argv[1][0] != '-') {
 		fatalError("Quanta did not recognize command!\n");
 	}
@@ -100,6 +130,15 @@ int parseArguments(int argc, char* argv[]) {
 	case 'T':
 		printf("Testing integrity of files\n");
 		break;
+	case 'B':
+		if (argc != 6)
+			fatalError("-b takes the archive, a file in it, an offset and a length\n");
+		break; //the bytes are the output, nothing else may go to standard output
+	case 'G':
+		if (argc <= 3)
+			fatalError("No search pattern or archive given!\n");
+		printf("Searching files\n");
+		break;
 	case 'L':
 		printf("Listing archive contents\n");
 		break;
@@ -113,12 +152,71 @@ int parseArguments(int argc, char* argv[]) {
 			fatalError("No files listed!");
 		printf("Deleting files from archive\n");
 		break;
+	case 'C':
+		printf("Compacting archive\n");
+		break;
 	default:
 		fatalError("Quanta did not recognize command!\n");
 	}
 	return command;
 }
 
+//options sit between the command and the archive name, they are removed from argv once parsed
+int parseOptions(int argc, char* argv[]) {
+	int i{ 2 }, value{};
+	while (i + 1 < argc && argv[i][0] == '-' && strlen(argv[i]) == 2) {
+		value = atoi(argv[i + 1]);
+		if (value < 1)
+			fatalError("Option " + std::string{ argv[i] } + " needs a positive number\n");
+		switch (toupper(argv[i][1])) {
+		case 'J':
+			workerCount = value;
+			break;
+		case 'M':
+			memoryCap = static_cast<std::uint64_t>(value) << 20;
+			break;
+		case 'E':
+			selectionEffort = std::min(value, 3);
+			break;
+		case 'W':
+			compactThreshold = std::min(value, 100);
+			break;
+		case 'S':
+			solidBlockSize = static_cast<std::uint64_t>(std::min(value, MAX_SOLID_BLOCK_MB)) << 20;
+			break;
+		case 'K':
+			dedupChunkSize = static_cast<std::size_t>(std::min(value, 1 << 16)) << 10;
+			break;
+		case 'F':
+			frameSize = static_cast<std::size_t>(std::min(value, MAX_FRAME_KB)) << 10;
+			frameTables = true;
+			break;
+		default:
+			fatalError("Quanta did not recognize option " + std::string{ argv[i] } + "\n");
+		}
+		i += 2;
+	}
+	std::copy(argv + i, argv + argc, argv + 2);
+	return argc - (i - 2);
+}
+
+//a number of bytes, optionally followed by k, m or g for KB, MB or GB
+std::uint64_t parseByteCount(const char* text) {
+	char* end{};
+	std::uint64_t count = std::strtoull(text, &end, 10);
+	int shift{ 0 };
+	switch (std::tolower(static_cast<unsigned char>(*end))) {
+	case 'k': shift = 10; break;
+	case 'm': shift = 20; break;
+	case 'g': shift = 30; break;
+	case '\0': break;
+	default: shift = -1;
+	}
+	if (end == text || *text == '-' || shift < 0 || (shift != 0 && end[1] != '\0') || count > (UINT64_MAX >> shift))
+		fatalError("Not a number of bytes: " + std::string{ text } + "\n");
+	return count << shift;
+}
+
 void testCRCTable() {
 	int i{}, j{};
 	unsigned long value{};
@@ -156,7 +254,17 @@ void openArchiveFiles(char* name, char command) {
 	}
 	if (!inputCarFile.is_open() && command != 'A')
 		fatalError("Can't open archive: " + std::string{ carFileName });
-	if (command == 'A' || command == 'R' || command == 'D') {
+	if (inputCarFile.is_open()) {
+		try {
+			inputDirectory = ArchiveDirectory::open(carFileName);
+		}
+		catch (stl::FileError const& error) {
+			fatalError(error.what());
+		}
+	}
+	//A, R and D update the archive where it is, only -c rewrites it through the temporary file. The
+	//name is picked either way, the parallel add names its spill files after it.
+	if (command == 'A' || command == 'R' || command == 'D' || command == 'C') {
 		strcpy(tempFileName, carFileName);
 		s = strrchr(tempFileName, '.');
 		if (s == nullptr)
@@ -169,20 +277,28 @@ void openArchiveFiles(char* name, char command) {
 		}
 		if (i == 10)
 			fatalError("Can't open temporary file " + std::string{ tempFileName });
-		outputCarFile = std::fstream{ tempFileName, std::ios_base::out | std::ios_base::binary };
+	}
+	if (command == 'A' || command == 'R' || command == 'D') {
+		auto mode = std::ios_base::in | std::ios_base::out | std::ios_base::binary;
+		outputCarFile = std::fstream{ carFileName, inputCarFile.is_open() ? mode : mode | std::ios_base::trunc };
 		if (!outputCarFile.is_open())
-			fatalError("Can't open temporary file " + std::string{ tempFileName });
+			fatalError("Can't open archive for update: " + std::string{ carFileName });
 	}
 }
 
+void openTemporaryFile() {
+	outputCarFile = std::fstream{ tempFileName, std::ios_base::out | std::ios_base::binary };
+	if (!outputCarFile.is_open())
+		fatalError("Can't open temporary file " + std::string{ tempFileName });
+}
 
-void normalizeFileName(int count, std::string fname) {
+void normalizeFileName(std::string fname) {
 	std::transform(std::begin(fname), std::end(fname), std::begin(fname), ::tolower);
-	fileList[count] = fname;
+	fileList.push_back(fname);
 }
 
 
-int expandAndNormalizeFileNames(int count, std::string& fname) {
+void expandAndNormalizeFileNames(std::string& fname) {
 	if (fname.starts_with("*")) {
 		std::string extension = fname.substr(1, std::size(fname) - 1);
 		auto filter = [&extension](fs::path const& path) {
@@ -190,156 +306,1832 @@ int expandAndNormalizeFileNames(int count, std::string& fname) {
 		};
 		for (auto& entry : fs::directory_iterator(fs::current_path())) {
 			if (fs::is_regular_file(entry) && filter(entry))
-				normalizeFileName(count++, fs::path(entry).string());
-			if (count > 99)
-				fatalError("Too many filenames");
+				normalizeFileName(fs::path(entry).string());
 		}
 	}
 	else
-		normalizeFileName(count++, fname);
-	return count;
+		normalizeFileName(fname);
 }
 
 
 int buildFileList(int argc, char* argv[], int command) {
-	int i, count{ 0 };
 	if (argc == 0)
-		fileList[count++] = {"*"};
-	else {
-		for (i = 0; i < argc; ++i) {
+		fileList.push_back("*");
+	for (int i = 0; i < argc; ++i) {
 #if defined (_WIN32)
-			std::string fname = argv[i];
-			if (command == 'A')
-				count = expandAndNormalizeFileNames(count, fname);
-			else
-				normalizeFileName(count++, fname);
+		std::string fname = argv[i];
+		if (command == 'A')
+			expandAndNormalizeFileNames(fname);
+		else
+			normalizeFileName(fname);
 #endif
 #if defined (__linux__)
-			fileList[count++] argv[i];
+		fileList.push_back(argv[i]);
 #endif
-			if (count > 99)
-				fatalError("Too many filenames");
-		}
 	}
-	return count;
+	return static_cast<int>(fileList.size());
 }
 
-std::uint32_t calculateBlockCRC32(unsigned count, std::uint32_t crc, void* buffer) {
-	unsigned char* ptr = (unsigned char*)buffer;
-	std::uint32_t temp1{}, temp2{};
-	unsigned i{ 0 };
-	while (count-- != 0) {
-		temp1 = (crc >> 8) & 0x00ffffff;
-		temp2 = ccitt32Table[(int)*ptr++ & 0xff];
-		crc = temp1 ^ temp2;
-	}
-	return crc;
-}
-
-void packUnsignedData(int numberOfBytes, std::uint32_t number, unsigned char* buffer) {
+void packUnsignedData(int numberOfBytes, std::uint64_t number, unsigned char* buffer) {
 	while (numberOfBytes-- > 0) {
 		*buffer++ = (unsigned char)number & 0xff;
 		number >>= 8;
 	}
 }
 
+std::uint64_t unpackUnsignedData(int numberOfBytes, unsigned char* buffer) {
+	std::uint64_t number{ 0 };
+	while (numberOfBytes-- > 0)
+		number = (number << 8) | buffer[numberOfBytes];
+	return number;
+}
+
+//The header CRC covers the file name, terminator included, and the packed header fields: the method, the
+//sizes of 8 bytes each, the CRC and the dictionary ID.
 void writeFileHeader() {
-	unsigned char headerData[17];
+	unsigned char headerData[29];
 	unsigned i{};
-	for (i = 0; ++i; ) {
+	for (i = 0; ; ++i) {
 		outputCarFile.put(header.filename[i]);
 		if (header.filename[i] == '\0')
 			break;
 	}
-	header.originalCRC = calculateBlockCRC32(i, CRC_MASK, header.filename);
-	packUnsignedData(1, (std::uint32_t)header.compressionMethod, headerData + 0);
-	packUnsignedData(4, header.originalSize, headerData + 1);
-	packUnsignedData(4, header.compressedSize, headerData + 5);
-	packUnsignedData(4, header.originalCRC, headerData + 9);
-	header.headerCRC = calculateBlockCRC32(13, header.headerCRC, headerData);
+	header.headerCRC = calculateBlockCRC32(i + 1, CRC_MASK, header.filename);
+	packUnsignedData(1, static_cast<unsigned char>(header.compressionMethod), headerData + 0);
+	packUnsignedData(8, header.originalSize, headerData + 1);
+	packUnsignedData(8, header.compressedSize, headerData + 9);
+	packUnsignedData(4, header.originalCRC, headerData + 17);
+	packUnsignedData(4, header.dictionaryID, headerData + 21);
+	header.headerCRC = calculateBlockCRC32(25, header.headerCRC, headerData);
 	header.headerCRC ^= CRC_MASK;
-	packUnsignedData(4, header.headerCRC, headerData + 13);
-	outputCarFile.write(reinterpret_cast<char*>(headerData), 17);
+	packUnsignedData(4, header.headerCRC, headerData + 25);
+	outputCarFile.write(reinterpret_cast<char*>(headerData), 29);
+}
+
+//Reads the next header of an archive into memberHeader, returns false once the members are exhausted.
+//Damaged headers are reported as stl::FileError.
+bool readFileHeader(std::istream& archive, Header& memberHeader) {
+	unsigned char headerData[29];
+	int i{}, c{};
+	if (inputDirectory && static_cast<std::uint64_t>(archive.tellg()) >= inputDirectory->offset())
+		return false;
+	for (i = 0; ; ++i) {
+		if ((c = archive.get()) == EOF)
+			return false;
+		memberHeader.filename[i] = (char)c;
+		if (c == '\0')
+			break;
+		if (i == FILENAME_MAX_LENGTH - 1)
+			throw stl::FileError("File name exceeded maximum in header");
+	}
+	if ((c = archive.get()) == EOF)
+		throw stl::FileError("Truncated header for file " + std::string{ memberHeader.filename });
+	headerData[0] = static_cast<unsigned char>(c);
+	memberHeader.compressionMethod = static_cast<char>(c);
+	archive.read(reinterpret_cast<char*>(headerData + 1), 28);
+	if (archive.gcount() != 28)
+		throw stl::FileError("Truncated header for file " + std::string{ memberHeader.filename });
+	memberHeader.originalSize = unpackUnsignedData(8, headerData + 1);
+	memberHeader.compressedSize = unpackUnsignedData(8, headerData + 9);
+	memberHeader.originalCRC = static_cast<std::uint32_t>(unpackUnsignedData(4, headerData + 17));
+	memberHeader.dictionaryID = static_cast<std::uint32_t>(unpackUnsignedData(4, headerData + 21));
+	memberHeader.headerCRC = static_cast<std::uint32_t>(unpackUnsignedData(4, headerData + 25));
+	std::uint32_t crc = calculateBlockCRC32(i + 1, CRC_MASK, memberHeader.filename);
+	crc = calculateBlockCRC32(25, crc, headerData) ^ CRC_MASK;
+	if (crc != memberHeader.headerCRC)
+		throw stl::FileError("Header checksum error for file " + std::string{ memberHeader.filename });
+	return true;
 }
 
-void insert(std::fstream& infile, const char* str) {
-	long savedPositonOfHeader{}, savedPositionOfFile{};
-	printf("\nAdding %s to archive\n", header.filename);
-	savedPositonOfHeader = outputCarFile.tellg();
-	header.compressionMethod = 2;
+//reads a chunk that is already in memory
+struct MemoryBuffer : std::streambuf {
+	MemoryBuffer(char* data, std::size_t size) {
+		setg(data, data, data + size);
+	}
+};
+
+//Codes one chunk into coded and returns the method it ended up with. A coder whose output outgrows the
+//chunk read so far by more than EXPANSION_LIMIT_PERCENT is cut off, checked every 64 KB, and the chunk
+//is stored instead, as is a chunk that came out larger than it went in.
+int compressChunk(int method, char* chunk, std::size_t length, std::stringstream& coded) {
+	if (method == METHOD_STORED)
+		return METHOD_STORED;
+	coded.str({});
+	coded.clear();
+	MemoryBuffer memory{ chunk, length };
+	CRCInputBuffer limited{ memory };
+	limited.stopWhen([&] {
+		return static_cast<std::uint64_t>(coded.tellp()) > limited.size() * (100 + EXPANSION_LIMIT_PERCENT) / 100;
+	});
+	std::istream input{ &limited };
+	auto output = stl::attachBitFile(coded);
+	compressWithMethod(method, input, output);
+	stl::closeOutputBitFile(output);
+	if (limited.stopped() || static_cast<std::uint64_t>(coded.tellp()) >= length)
+		return METHOD_STORED;
+	return method;
+}
+
+//A chunk on its way out: the source bytes, what they were coded into and the header that goes before them.
+struct CodedChunk {
+	std::vector<char> data;
+	std::size_t length{};
+	std::stringstream coded;
+	int method{};
+	unsigned char header[CHUNK_HEADER_SIZE]{};
+
+	//codes the chunk with compressChunk and fills in the header, returns the bytes it takes in the member
+	std::uint64_t code(int requestedMethod) {
+		method = compressChunk(requestedMethod, data.data(), length, coded);
+		std::uint64_t codedLength = (method == METHOD_STORED) ? length : static_cast<std::uint64_t>(coded.tellp());
+		packUnsignedData(1, method, header);
+		packUnsignedData(4, length, header + 1);
+		packUnsignedData(4, codedLength, header + 5);
+		return CHUNK_HEADER_SIZE + codedLength;
+	}
+	void write(std::ostream& target) {
+		target.write(reinterpret_cast<char*>(header), CHUNK_HEADER_SIZE);
+		if (method == METHOD_STORED)
+			target.write(data.data(), length);
+		else
+			target << coded.rdbuf();
+	}
+};
+
+//Codes the source into target chunkSize bytes at a time, each chunk behind a CHUNK_HEADER_SIZE header, with
+//the method prepare returns for it. prepare is given the chunk and where it goes within what is written.
+//Reading, coding and writing overlap: a reader thread fills the next chunks while the calling thread codes
+//one and a writer thread writes out those already coded, and the stages hand chunks on in order through
+//bounded queues. PIPELINE_CHUNKS chunks go round between them, so memory stays bounded whatever the size of
+//the source. A source that fits in one chunk, as most files do, is coded without the threads. An error in
+//any stage closes the queues, so the others run out of chunks, and is rethrown once the threads are joined.
+template <typename Prepare>
+void writeChunks(CRCInputBuffer& source, std::ostream& target, std::size_t chunkSize, Prepare prepare) {
+	std::array<CodedChunk, PIPELINE_CHUNKS> chunks;
+	CodedChunk& first = chunks.front();
+	first.data.resize(chunkSize);
+	first.length = static_cast<std::size_t>(std::max<std::streamsize>(source.sgetn(first.data.data(), chunkSize), 0));
+	if (first.length < chunkSize) {
+		if (first.length != 0) {
+			first.code(prepare(first.data.data(), first.length, std::uint64_t{ 0 }));
+			first.write(target);
+		}
+		return;
+	}
+	BoundedQueue<CodedChunk*> spare{ PIPELINE_CHUNKS }, read{ PIPELINE_CHUNKS }, coded{ PIPELINE_CHUNKS };
+	for (std::size_t i = 1; i < chunks.size(); ++i)
+		spare.push(&chunks[i]);
+	read.push(&first);
+	auto stop = [&] {
+		spare.close();
+		read.close();
+		coded.close();
+	};
+	std::exception_ptr readError, writeError;
+	std::jthread reader{ [&] {
+		try {
+			for (CodedChunk* chunk; spare.pop(chunk); read.push(chunk)) {
+				chunk->data.resize(chunkSize);
+				chunk->length = static_cast<std::size_t>(std::max<std::streamsize>(source.sgetn(chunk->data.data(), chunkSize), 0));
+				if (chunk->length == 0)
+					break;
+			}
+		}
+		catch (...) {
+			readError = std::current_exception();
+			stop();
+		}
+		read.close();
+	} };
+	std::jthread writer{ [&] {
+		try {
+			for (CodedChunk* chunk; coded.pop(chunk); spare.push(chunk))
+				chunk->write(target);
+		}
+		catch (...) {
+			writeError = std::current_exception();
+			stop();
+		}
+	} };
+	std::uint64_t position{ 0 };
+	try {
+		for (CodedChunk* chunk; read.pop(chunk); coded.push(chunk))
+			position += chunk->code(prepare(chunk->data.data(), chunk->length, position));
+	}
+	catch (...) {
+		stop();
+		throw;
+	}
+	coded.close();
+	reader.join();
+	writer.join();
+	if (readError)
+		std::rethrow_exception(readError);
+	if (writeError)
+		std::rethrow_exception(writeError);
+}
+
+//Ends the chunks of a framed member: a FRAME_TABLE_CHUNK header of source size 0, the FRAME_RECORD_SIZE
+//records of its chunks, the number of them and FRAME_TABLE_MAGIC. A range read finds the table from the
+//end of the member data and expands only the chunks that overlap the range.
+void writeFrameTable(std::ostream& target, std::string const& records) {
+	unsigned char chunkHeader[CHUNK_HEADER_SIZE], trailer[8];
+	packUnsignedData(1, FRAME_TABLE_CHUNK, chunkHeader);
+	packUnsignedData(4, 0, chunkHeader + 1);
+	packUnsignedData(4, records.size() + sizeof trailer, chunkHeader + 5);
+	packUnsignedData(4, records.size() / FRAME_RECORD_SIZE, trailer);
+	std::memcpy(trailer + 4, FRAME_TABLE_MAGIC, 4);
+	target.write(reinterpret_cast<char*>(chunkHeader), CHUNK_HEADER_SIZE);
+	target.write(records.data(), records.size());
+	target.write(reinterpret_cast<char*>(trailer), sizeof trailer);
+}
+
+//The source is read once, chunkSize bytes at a time: the input stage checksums and counts them,
+//then the chunk is coded with the method set in memberHeader behind a CHUNK_HEADER_SIZE header giving
+//the method it was coded with, its size and its coded size, see writeChunks. Every chunk starts its coder
+//afresh, so memory stays bounded however large the member is and no coder sees more than one chunk. With
+//frameTable the chunks are followed by a table of them, see writeFrameTable. Fills in the sizes and CRC of
+//memberHeader.
+void compressMember(std::istream& infile, std::ostream& target, Header& memberHeader, std::size_t chunkSize = MEMBER_CHUNK_SIZE, bool frameTable = false) {
+	auto dataPosition = target.tellp();
+	CRCInputBuffer source{ *infile.rdbuf() };
+	std::string records;
+	ContentHasher hasher;
+	std::uint64_t sourceOffset{ 0 };
+	writeChunks(source, target, chunkSize, [&](const char* chunk, std::size_t length, std::uint64_t position) {
+		hasher.update(reinterpret_cast<const unsigned char*>(chunk), length);
+		if (frameTable) {
+			unsigned char record[FRAME_RECORD_SIZE];
+			packUnsignedData(8, sourceOffset, record);
+			packUnsignedData(8, position, record + 8);
+			packUnsignedData(4, calculateBlockCRC32(length, CRC_MASK, chunk) ^ CRC_MASK, record + 16);
+			records.append(reinterpret_cast<char*>(record), FRAME_RECORD_SIZE);
+		}
+		sourceOffset += length;
+		return static_cast<int>(memberHeader.compressionMethod);
+	});
+	if (frameTable)
+		writeFrameTable(target, records);
+	memberHeader.originalSize = source.size();
+	memberHeader.originalCRC = source.crc();
+	memberHeader.contentHash = hasher.finish().low;
+	memberHeader.compressedSize = static_cast<std::uint64_t>(target.tellp() - dataPosition);
+}
+
+//adds the member in header, whose header was written at headerOffset, to the central directory
+void recordMember(std::uint64_t headerOffset) {
+	DirectoryEntry entry;
+	entry.name = header.filename;
+	entry.headerOffset = headerOffset;
+	entry.dataOffset = static_cast<std::uint64_t>(outputCarFile.tellp()) - header.compressedSize;
+	entry.originalSize = header.originalSize;
+	entry.compressedSize = header.compressedSize;
+	entry.originalCRC = header.originalCRC;
+	entry.dictionaryID = header.dictionaryID;
+	entry.compressionMethod = header.compressionMethod;
+	entry.modified = header.modified;
+	entry.contentHash = header.contentHash;
+	outputDirectory.push_back(std::move(entry));
+}
+
+//The header goes out with the sizes and CRC still zero and is patched with one seek afterwards,
+//so pipes and other sources that cannot seek can be archived too.
+void insert(std::istream& infile, std::size_t chunkSize = MEMBER_CHUNK_SIZE, bool frameTable = false) {
+	auto headerPosition = outputCarFile.tellp();
+	header.originalSize = header.compressedSize = header.originalCRC = 0;
+	writeFileHeader();
+	compressMember(infile, outputCarFile, header, chunkSize, frameTable);
+	auto endPosition = outputCarFile.tellp();
+	outputCarFile.seekp(headerPosition);
 	writeFileHeader();
-	savedPositionOfFile = outputCarFile.tellg();
-	infile.seekg(0, std::ios_base::end);
-	header.originalSize = infile.tellg();
-	infile.seekg(0, std::ios_base::beg);
-	if (!LZSSCompress(infile)) {
+	outputCarFile.seekp(endPosition);
+	recordMember(headerPosition);
+}
 
+//copies count bytes of the member name, whose data ends early is reported as stl::FileError. output is a
+//stream or an OutputSink.
+template <typename Output>
+void copyStream(std::istream& input, Output& output, std::uint64_t count, std::string const& name) {
+	char buffer[1 << 16];
+	while (count != 0) {
+		std::size_t chunk = static_cast<std::size_t>(std::min<std::uint64_t>(count, sizeof buffer));
+		input.read(buffer, chunk);
+		if (static_cast<std::size_t>(input.gcount()) != chunk)
+			throw stl::FileError("Truncated data for file " + name);
+		output.write(buffer, chunk);
+		count -= chunk;
 	}
 }
 
 
-void addFileListToArchive(int count) {
-	bool skip{ false };
-	int i{}, j{};
-	std::string::size_type pos;
+//the last write time of a file in ticks of the file clock, 0 when it cannot be had
+std::int64_t modifiedTime(std::string const& path) {
+	std::error_code error;
+	auto time = fs::last_write_time(path, error);
+	return error ? 0 : static_cast<std::int64_t>(time.time_since_epoch().count());
+}
+
+//the content hash of a file, as compressMember takes it, false when the file cannot be read
+bool hashFile(std::string const& path, std::uint64_t& contentHash) {
+	std::ifstream input{ path, std::ios_base::binary };
+	if (!input.is_open())
+		return false;
+	ContentHasher hasher;
+	std::vector<char> buffer(1 << 20);
+	while (input.read(buffer.data(), buffer.size()) || input.gcount() > 0)
+		hasher.update(reinterpret_cast<unsigned char*>(buffer.data()), static_cast<std::size_t>(input.gcount()));
+	contentHash = hasher.finish().low;
+	return input.eof();
+}
+
+//Picks the files listed for -a and -r that are added, one at a time as they are listed. A file whose member
+//name is already taken, or too long for a header, is dropped, as is, for -r, one that is not in the archive. So is one whose member is
+//unchanged, which stays as it is with nothing read or written for it: the file has the size and last write
+//time the member was added with, or the size and the content hash, which is only computed when the times
+//differ, and then the member gets the new time. Members whose time is not known, as in archives without a
+//central directory, are always replaced. The members of the archive are the entries of outputDirectory once
+//the update has begun.
+class AddSelection {
+public:
+	explicit AddSelection(bool replaceOnly) : replaceOnly{ replaceOnly } {
+		for (std::size_t i = 0; i < outputDirectory.size(); ++i)
+			members.emplace(outputDirectory[i].name, i);
+	}
+
+	bool take(WalkedFile const& file) {
+		if (file.name.size() >= FILENAME_MAX_LENGTH) {
+			printf("%s is too long a name to store, skipped\n", file.name.c_str());
+			return false;
+		}
+		if (!names.insert(file.name).second) {
+			printf("Duplicate file detected: %s\n", file.name.c_str());
+			return false;
+		}
+		auto member = members.find(file.name);
+		if (member == std::end(members)) {
+			if (replaceOnly) {
+				fprintf(stderr, "%s is not in the archive\n", file.name.c_str());
+				++missing;
+			}
+			return !replaceOnly;
+		}
+		if (isUnchanged(file.path, outputDirectory[member->second])) {
+			++unchanged;
+			return false;
+		}
+		replaced.insert(file.name);
+		return true;
+	}
+
+	std::unordered_set<std::string> replaced; //names of the members the files taken replace
+	std::size_t unchanged{ 0 };
+	std::size_t missing{ 0 }; //files listed for -r that are not in the archive
+
+private:
+	static bool isUnchanged(std::string const& path, DirectoryEntry& entry) {
+		if (entry.modified == 0)
+			return false;
+		std::error_code error;
+		auto size = fs::file_size(path, error);
+		std::int64_t modified = modifiedTime(path);
+		if (error || size != entry.originalSize || modified == 0)
+			return false;
+		if (modified == entry.modified)
+			return true;
+		std::uint64_t contentHash{};
+		if (!hashFile(path, contentHash) || contentHash != entry.contentHash)
+			return false;
+		entry.modified = modified;
+		return true;
+	}
+
+	bool replaceOnly;
+	std::unordered_set<std::string> names; //member names of the files listed so far
+	std::unordered_map<std::string, std::size_t> members; //index in outputDirectory of each member by name
+};
+
+//hands out the files to add one at a time, false once there are no more
+using FileSource = std::function<bool(WalkedFile&)>;
+
+FileSource listedFiles(std::vector<WalkedFile> const& files) {
+	return [&files, next = std::size_t{ 0 }](WalkedFile& file) mutable {
+		if (next == files.size())
+			return false;
+		file = files[next++];
+		return true;
+	};
+}
+
+void setHeaderFileName(Header& memberHeader, std::string const& name) {
+	strncpy(memberHeader.filename, name.c_str(), FILENAME_MAX_LENGTH - 1);
+	memberHeader.filename[FILENAME_MAX_LENGTH - 1] = '\0';
+}
+
+void addFileListToArchive(FileSource const& next) {
 	std::fstream inputFile;
-	for (i = 0; i < count; ++i) {
-		inputFile.open(fileList[i], std::ios_base::in | std::ios_base::binary);
+	for (WalkedFile file; next(file); ) {
+		inputFile.open(file.path, std::ios_base::in | std::ios_base::binary);
 		if (!inputFile.is_open())
-			fatalError("quanta could not open " + fileList[i]);
-#if defined (_WIN32)
-		pos = fileList[i].rfind("\\");
-		if (pos == std::string::npos)
-			pos = fileList[i].rfind(":");
-#endif
-#if defined (__linux__)
-		pos = fileList[i].rfind("/");
-#endif
-		std::string s = (pos == std::string::npos) ? fileList[i] : fileList[i].substr(++pos, fileList[i].size() - pos);
-		
-		for (j = 0; j < i; ++j) {
-			if (s == fileList[j]) {
-				printf("Duplicate file detected: %s", s.c_str());
-				skip = true;
+			throw stl::FileError("quanta could not open " + file.path + "\n");
+		setHeaderFileName(header, file.name);
+		header.modified = modifiedTime(file.path);
+		MethodChoice choice = selectMethod(file.path, selectionEffort);
+		header.compressionMethod = static_cast<char>(choice.method);
+		printf("\nAdding %s to archive\n", header.filename);
+		insert(inputFile, frameSize, frameTables);
+		printf("%s\n", describeChoice(choice).c_str());
+		inputFile.close();
+	}
+}
+
+//A member compressed by a worker, waiting for the writer. Its compressed data is held in memory,
+//or in a spill file when the source is too large to buffer.
+struct PendingMember {
+	std::string path;
+	Header header{};
+	std::stringstream data;
+	std::string spillName;
+	std::string selection; //how the method was chosen, logged by the writer so the log keeps list order
+	std::string error;
+	bool ready{ false };
+};
+
+void compressPendingMember(PendingMember& member) {
+	std::fstream inputFile{ member.path, std::ios_base::in | std::ios_base::binary };
+	if (!inputFile.is_open()) {
+		member.error = "quanta could not open " + member.path;
+		return;
+	}
+	member.header.modified = modifiedTime(member.path);
+	MethodChoice choice = selectMethod(member.path, selectionEffort);
+	member.header.compressionMethod = static_cast<char>(choice.method);
+	member.selection = describeChoice(choice);
+	if (member.spillName.empty()) {
+		compressMember(inputFile, member.data, member.header, frameSize, frameTables);
+		return;
+	}
+	std::fstream spillFile{ member.spillName, std::ios_base::in | std::ios_base::out | std::ios_base::trunc | std::ios_base::binary };
+	if (!spillFile.is_open())
+		member.error = "Can't open temporary file " + member.spillName;
+	else
+		compressMember(inputFile, spillFile, member.header, frameSize, frameTables);
+}
+
+//Workers take the files in list order and compress them concurrently, the calling thread appends the
+//members in that same order as they finish, so the archive does not depend on the number of workers.
+//The calling thread also lists the files, up to MAX_QUEUED_FILES ahead of the member it writes next, so
+//compression starts with the first file rather than once the list is complete. A worker does not start
+//on another file while more than memoryCap compressed bytes wait in memory, unless it is the file the
+//writer is waiting for. Sources larger than their share of the cap are compressed into spill files next
+//to the archive instead of into memory. On an error the workers finish the files they are on and stop,
+//and the error is rethrown once they are joined and the spill files removed.
+void addFileListToArchiveInParallel(FileSource const& next) {
+	std::deque<PendingMember> members; //listed and not yet written
+	std::uint64_t spillThreshold = memoryCap / workerCount;
+	std::mutex mutex;
+	std::condition_variable changed;
+	std::size_t started{ 0 }; //members at the front of the queue a worker has taken
+	std::uint64_t bufferedBytes{ 0 };
+	bool listed{ false }; //every file to add has been queued
+	bool failed{ false }; //the writer has given up, no more files are started
+	auto worker = [&] {
+		std::unique_lock lock{ mutex };
+		for (;;) {
+			changed.wait(lock, [&] {
+				return failed || (started == members.size() ? listed : (started == 0 || bufferedBytes < memoryCap));
+			});
+			if (failed || started == members.size())
+				return;
+			PendingMember& member = members[started++];
+			lock.unlock();
+			compressPendingMember(member);
+			lock.lock();
+			member.ready = true;
+			if (member.spillName.empty())
+				bufferedBytes += member.header.compressedSize;
+			changed.notify_all();
+		}
+	};
+	std::vector<std::jthread> workers;
+	for (unsigned i = 0; i < workerCount; ++i)
+		workers.emplace_back(worker);
+	try {
+		for (std::size_t count{ 0 }; ; ) {
+			bool listing = !listed && members.size() < MAX_QUEUED_FILES;
+			if (listing) {
+				WalkedFile file;
+				std::string spillName;
+				bool found = next(file);
+				if (found) {
+					std::error_code error;
+					auto size = fs::file_size(file.path, error);
+					if (!error && size > spillThreshold)
+						spillName = std::string{ tempFileName } + "." + std::to_string(count);
+				}
+				std::lock_guard lock{ mutex };
+				if (found) {
+					PendingMember& member = members.emplace_back();
+					member.path = std::move(file.path);
+					member.spillName = std::move(spillName);
+					setHeaderFileName(member.header, file.name);
+					++count;
+				}
+				else
+					listed = true;
+				changed.notify_all();
+			}
+			{
+				std::unique_lock lock{ mutex };
+				if (members.empty() && listed)
+					break;
+				if (listing && (members.empty() || !members.front().ready))
+					continue; //list more while the next member is compressed
+				changed.wait(lock, [&] { return members.front().ready; });
+			}
+			PendingMember& member = members.front();
+			if (!member.error.empty())
+				throw stl::FileError(member.error + "\n");
+			printf("\nAdding %s to archive\n%s\n", member.header.filename, member.selection.c_str());
+			header = member.header;
+			auto headerPosition = outputCarFile.tellp();
+			writeFileHeader();
+			if (member.spillName.empty())
+				copyStream(member.data, outputCarFile, header.compressedSize, member.path);
+			else {
+				std::fstream spillFile{ member.spillName, std::ios_base::in | std::ios_base::binary };
+				copyStream(spillFile, outputCarFile, header.compressedSize, member.spillName);
+				spillFile.close();
+				fs::remove(member.spillName);
+			}
+			recordMember(headerPosition);
+			std::lock_guard lock{ mutex };
+			if (member.spillName.empty())
+				bufferedBytes -= member.header.compressedSize;
+			members.pop_front();
+			--started;
+			changed.notify_all();
+		}
+	}
+	catch (...) {
+		{
+			std::lock_guard lock{ mutex };
+			failed = true;
+		}
+		changed.notify_all();
+		workers.clear();
+		for (auto& member : members) {
+			std::error_code error;
+			if (!member.spillName.empty())
+				fs::remove(member.spillName, error);
+		}
+		throw;
+	}
+}
+
+bool isSolidBlock(std::string const& name) {
+	return name.starts_with(SOLID_BLOCK_PREFIX);
+}
+
+//members whose data is a list of extents in solid blocks rather than coded data of their own
+bool isBlockReference(int method) {
+	return method == SOLID_MEMBER_METHOD || method == DEDUP_MEMBER_METHOD;
+}
+
+//length bytes of the expanded solid block whose header is at block, starting at offset
+struct Extent {
+	std::uint64_t block{};
+	std::uint64_t offset{};
+	std::uint64_t length{};
+};
+
+//Takes the files smaller than solidBlockSize out of files and returns them ordered by extension and then
+//size, so that files of one kind, and of similar kinds of content, end up next to each other in a block.
+std::vector<WalkedFile> takeSolidFiles(std::vector<WalkedFile>& files) {
+	std::vector<std::pair<WalkedFile, std::uint64_t>> solid;
+	std::erase_if(files, [&solid](WalkedFile const& file) {
+		std::error_code error;
+		auto size = fs::file_size(file.path, error);
+		if (error || size >= solidBlockSize)
+			return false;
+		solid.emplace_back(file, size);
+		return true;
+	});
+	std::stable_sort(std::begin(solid), std::end(solid), [](auto const& a, auto const& b) {
+		auto extensionA = fs::path(a.first.path).extension().string(), extensionB = fs::path(b.first.path).extension().string();
+		return extensionA != extensionB ? extensionA < extensionB : a.second < b.second;
+	});
+	std::vector<WalkedFile> solidFiles;
+	for (auto& file : solid)
+		solidFiles.push_back(std::move(file.first));
+	return solidFiles;
+}
+
+//a member of the solid block being filled, at offset within the block
+struct SolidMember {
+	std::string name;
+	std::uint64_t offset{};
+	std::uint64_t size{};
+	std::uint32_t crc{};
+	std::int64_t modified{};
+	std::uint64_t contentHash{};
+};
+
+//A block goes out as one member coded as a single chunk, with the method picked for the block as a whole.
+//Returns the offset of its header, which the members kept in it refer to.
+std::uint64_t writeBlock(std::string const& block, std::string const& contents) {
+	MethodChoice choice = selectMethod(std::string_view{ block }, selectionEffort);
+	auto blockPosition = static_cast<std::uint64_t>(outputCarFile.tellp());
+	setHeaderFileName(header, SOLID_BLOCK_PREFIX + std::to_string(blockPosition));
+	header.compressionMethod = static_cast<char>(choice.method);
+	header.dictionaryID = 0;
+	header.modified = 0;
+	printf("\nAdding a solid block of %s, %zu bytes\n%s\n", contents.c_str(), block.size(), describeChoice(choice).c_str());
+	std::istringstream input{ block };
+	insert(input, std::max<std::size_t>(block.size(), 1));
+	return blockPosition;
+}
+
+//The block is followed by a member for each file whose data is a SOLID_RECORD_SIZE record giving the
+//block's header offset and the file's offset in the expanded block. The records keep the files' names,
+//sizes and CRCs in their own headers, so a pass over the headers finds them as it finds any other member.
+void writeSolidBlock(std::string const& block, std::vector<SolidMember> const& members) {
+	auto blockPosition = writeBlock(block, std::to_string(members.size()) + " files");
+	for (auto& member : members) {
+		printf("Adding %s to the solid block\n", member.name.c_str());
+		auto headerPosition = outputCarFile.tellp();
+		setHeaderFileName(header, member.name);
+		header.compressionMethod = SOLID_MEMBER_METHOD;
+		header.originalSize = member.size;
+		header.compressedSize = SOLID_RECORD_SIZE;
+		header.originalCRC = member.crc;
+		header.modified = member.modified;
+		header.contentHash = member.contentHash;
+		writeFileHeader();
+		unsigned char record[SOLID_RECORD_SIZE];
+		packUnsignedData(8, blockPosition, record);
+		packUnsignedData(8, member.offset, record + 8);
+		outputCarFile.write(reinterpret_cast<char*>(record), SOLID_RECORD_SIZE);
+		recordMember(headerPosition);
+	}
+}
+
+//Concatenates the files into blocks of at most solidBlockSize bytes, each compressed as one stream.
+//Extracting a member expands no more than its block, so the block size bounds the cost of random access.
+void addFilesInSolidBlocks(std::vector<WalkedFile> const& files) {
+	std::string block;
+	std::vector<SolidMember> members;
+	for (auto& [path, name] : files) {
+		std::ifstream inputFile{ path, std::ios_base::binary | std::ios_base::ate };
+		if (!inputFile.is_open())
+			throw stl::FileError("quanta could not open " + path + "\n");
+		auto size = static_cast<std::uint64_t>(inputFile.tellg());
+		if (!members.empty() && block.size() + size > solidBlockSize) {
+			writeSolidBlock(block, members);
+			block.clear();
+			members.clear();
+		}
+		SolidMember member{ name, block.size(), size };
+		member.modified = modifiedTime(path);
+		block.resize(block.size() + size);
+		inputFile.seekg(0);
+		inputFile.read(block.data() + member.offset, size);
+		if (static_cast<std::uint64_t>(inputFile.gcount()) != size)
+			throw stl::FileError("quanta could not read " + path + "\n");
+		member.crc = calculateBlockCRC32(size, CRC_MASK, block.data() + member.offset) ^ CRC_MASK;
+		member.contentHash = fingerprintChunk(reinterpret_cast<unsigned char*>(block.data() + member.offset), size).low;
+		members.push_back(std::move(member));
+	}
+	if (!members.empty())
+		writeSolidBlock(block, members);
+}
+
+//A file whose chunks are waiting for their blocks to be written. Until then the block of an extent is
+//the number of the block in this run rather than its offset.
+struct DedupMember {
+	std::string name;
+	std::uint64_t size{};
+	std::uint32_t crc{};
+	std::int64_t modified{};
+	std::uint64_t contentHash{};
+	std::vector<Extent> extents{};
+};
+
+//The chunks in the archive and those seen so far in this run, by fingerprint, and the block their unique
+//bytes are collected in.
+struct Deduplicator {
+	ContentChunker chunker{ dedupChunkSize };
+	std::uint64_t blockSize{ solidBlockSize != 0 ? solidBlockSize : MEMBER_CHUNK_SIZE };
+	std::unordered_map<Fingerprint, Extent, FingerprintHash> chunks;
+	std::vector<std::uint64_t> blockOffsets; //header offsets of the blocks in the archive and those written, by number
+	std::string block;
+	std::deque<DedupMember> pending;
+	std::uint64_t totalBytes{ 0 };
+	std::uint64_t totalChunks{ 0 };
+	std::uint64_t uniqueBytes{ 0 };
+};
+
+void writeDedupMember(DedupMember const& member, std::vector<std::uint64_t> const& blockOffsets) {
+	auto headerPosition = outputCarFile.tellp();
+	setHeaderFileName(header, member.name);
+	header.compressionMethod = DEDUP_MEMBER_METHOD;
+	header.originalSize = member.size;
+	header.compressedSize = member.extents.size() * DEDUP_EXTENT_SIZE;
+	header.originalCRC = member.crc;
+	header.dictionaryID = 0;
+	header.modified = member.modified;
+	header.contentHash = member.contentHash;
+	writeFileHeader();
+	for (auto& extent : member.extents) {
+		unsigned char record[DEDUP_EXTENT_SIZE];
+		packUnsignedData(8, blockOffsets[extent.block], record);
+		packUnsignedData(8, extent.offset, record + 8);
+		packUnsignedData(4, extent.length, record + 16);
+		outputCarFile.write(reinterpret_cast<char*>(record), DEDUP_EXTENT_SIZE);
+	}
+	recordMember(headerPosition);
+}
+
+//writes the block being filled, then every waiting member whose chunks are all in written blocks
+void flushDedupBlock(Deduplicator& dedup) {
+	if (!dedup.block.empty()) {
+		dedup.blockOffsets.push_back(writeBlock(dedup.block, "unique chunks"));
+		dedup.block.clear();
+	}
+	while (!dedup.pending.empty() && std::all_of(std::begin(dedup.pending.front().extents), std::end(dedup.pending.front().extents),
+		[&dedup](Extent const& extent) { return extent.block < dedup.blockOffsets.size(); })) {
+		writeDedupMember(dedup.pending.front(), dedup.blockOffsets);
+		dedup.pending.pop_front();
+	}
+}
+
+//adds a chunk to member, as a reference to its earlier copy or as new bytes in the block being filled
+void deduplicateChunk(Deduplicator& dedup, DedupMember& member, const unsigned char* data, std::size_t size) {
+	auto [chunk, added] = dedup.chunks.try_emplace(fingerprintChunk(data, size));
+	if (added) {
+		if (dedup.block.size() + size > dedup.blockSize)
+			flushDedupBlock(dedup);
+		chunk->second = { dedup.blockOffsets.size(), dedup.block.size(), size };
+		dedup.block.append(reinterpret_cast<const char*>(data), size);
+		dedup.uniqueBytes += size;
+	}
+	Extent const& extent = chunk->second;
+	if (!member.extents.empty() && member.extents.back().block == extent.block
+		&& member.extents.back().offset + member.extents.back().length == extent.offset)
+		member.extents.back().length += extent.length; //consecutive chunks of one block are one extent
+	else
+		member.extents.push_back(extent);
+	dedup.totalBytes += size;
+	++dedup.totalChunks;
+}
+
+//The live members of the input archive, from its directory or, for archives without one, from a pass over
+//the headers that skips the members marked dead. Leaves membersEnd where their data ends.
+std::vector<DirectoryEntry> readMemberEntries() {
+	std::vector<DirectoryEntry> entries;
+	membersEnd = 0;
+	if (inputDirectory) {
+		entries.reserve(inputDirectory->size());
+		for (std::uint32_t i = 0; i < inputDirectory->size(); ++i)
+			entries.push_back(inputDirectory->entry(i));
+		membersEnd = inputDirectory->offset();
+		return entries;
+	}
+	if (!inputCarFile.is_open())
+		return entries;
+	inputCarFile.clear();
+	inputCarFile.seekg(0);
+	for (std::uint64_t headerOffset = 0; readFileHeader(inputCarFile, header); headerOffset = inputCarFile.tellg()) {
+		DirectoryEntry entry;
+		entry.name = header.filename;
+		entry.headerOffset = headerOffset;
+		entry.dataOffset = inputCarFile.tellg();
+		entry.originalSize = header.originalSize;
+		entry.compressedSize = header.compressedSize;
+		entry.originalCRC = header.originalCRC;
+		entry.dictionaryID = header.dictionaryID;
+		entry.compressionMethod = header.compressionMethod;
+		membersEnd = entry.dataOffset + entry.compressedSize;
+		if (entry.compressionMethod != DEAD_MEMBER_METHOD)
+			entries.push_back(std::move(entry));
+		inputCarFile.clear();
+		inputCarFile.seekg(membersEnd);
+	}
+	return entries;
+}
+
+//bytes between the start of the archive and membersEnd that belong to no live member
+std::uint64_t deadBytes(std::vector<DirectoryEntry> const& entries) {
+	std::uint64_t live{ 0 };
+	for (auto& entry : entries)
+		live += entry.dataOffset + entry.compressedSize - entry.headerOffset;
+	return membersEnd - live;
+}
+
+int deadPercentage(std::uint64_t dead) {
+	return membersEnd == 0 ? 0 : static_cast<int>(100 * dead / membersEnd);
+}
+
+//The extents a member kept in solid blocks is made of: the one of a SOLID_MEMBER_METHOD record, or the
+//list of DEDUP_EXTENT_SIZE ones of a DEDUP_MEMBER_METHOD member. Both start with the block's offset.
+std::vector<Extent> readExtents(std::istream& archive, DirectoryEntry const& entry) {
+	std::vector<unsigned char> records(static_cast<std::size_t>(entry.compressedSize));
+	archive.clear();
+	archive.seekg(entry.dataOffset);
+	archive.read(reinterpret_cast<char*>(records.data()), records.size());
+	if (static_cast<std::size_t>(archive.gcount()) != records.size())
+		throw stl::FileError("Truncated data for file " + entry.name);
+	std::vector<Extent> extents;
+	if (entry.compressionMethod == SOLID_MEMBER_METHOD && records.size() == SOLID_RECORD_SIZE)
+		extents.push_back({ unpackUnsignedData(8, records.data()), unpackUnsignedData(8, records.data() + 8), entry.originalSize });
+	for (std::size_t i = 0; entry.compressionMethod == DEDUP_MEMBER_METHOD && i + DEDUP_EXTENT_SIZE <= records.size(); i += DEDUP_EXTENT_SIZE)
+		extents.push_back({ unpackUnsignedData(8, records.data() + i), unpackUnsignedData(8, records.data() + i + 8), unpackUnsignedData(4, records.data() + i + 16) });
+	return extents;
+}
+
+int extentRecordSize(int method) {
+	return method == SOLID_MEMBER_METHOD ? SOLID_RECORD_SIZE : DEDUP_EXTENT_SIZE;
+}
+
+//Takes the named members out of outputDirectory, their space is only reclaimed by -c. A solid block goes
+//with the last member that refers to it, the members written in this update included, as deduplicated
+//ones refer to the blocks already in the archive.
+void supersedeMembers(std::unordered_set<std::string> const& names) {
+	bool referenceGone{ false };
+	std::erase_if(outputDirectory, [&](DirectoryEntry const& entry) {
+		if (entry.headerOffset >= membersEnd || !names.contains(entry.name))
+			return false;
+		referenceGone |= isBlockReference(entry.compressionMethod);
+		deadMembers.push_back(entry);
+		return true;
+	});
+	if (!referenceGone)
+		return;
+	std::unordered_set<std::uint64_t> referenced;
+	outputCarFile.flush();
+	for (auto& entry : outputDirectory) {
+		if (isBlockReference(entry.compressionMethod)) {
+			for (auto& extent : readExtents(inputCarFile, entry))
+				referenced.insert(extent.block);
+		}
+	}
+	std::erase_if(outputDirectory, [&referenced](DirectoryEntry const& entry) {
+		if (entry.headerOffset >= membersEnd || !isSolidBlock(entry.name) || referenced.contains(entry.headerOffset))
+			return false;
+		deadMembers.push_back(entry);
+		return true;
+	});
+}
+
+//rewrites the member's header in place with DEAD_MEMBER_METHOD, so a pass over the headers skips it too
+void markMemberDead(DirectoryEntry const& entry) {
+	setHeaderFileName(header, entry.name);
+	header.compressionMethod = DEAD_MEMBER_METHOD;
+	header.originalSize = entry.originalSize;
+	header.compressedSize = entry.compressedSize;
+	header.originalCRC = entry.originalCRC;
+	header.dictionaryID = entry.dictionaryID;
+	outputCarFile.seekp(entry.headerOffset);
+	writeFileHeader();
+}
+
+//Members are added or deleted without rewriting the archive: the live entries are loaded and writing
+//continues at the end of the member data, over the old directory. The old directory and trailer are kept
+//in archiveTail for restoreArchive, and the mapping of the old directory is released before it is overwritten.
+void beginArchiveUpdate() {
+	outputDirectory = readMemberEntries();
+	inputDirectory.reset();
+	archiveTail.reset();
+	if (inputCarFile.is_open()) {
+		inputCarFile.clear();
+		inputCarFile.seekg(0, std::ios_base::end);
+		std::uint64_t end = inputCarFile.tellg();
+		archiveTail.emplace(end - membersEnd, '\0');
+		inputCarFile.seekg(membersEnd);
+		inputCarFile.read(archiveTail->data(), archiveTail->size());
+		if (!inputCarFile)
+			fatalError("Can't read the directory of " + std::string{ carFileName });
+	}
+	outputCarFile.seekp(membersEnd);
+}
+
+//Undoes an update that failed before the superseded members were marked dead: the members written since
+//it began are cut off and the old directory and trailer put back, or the archive it created is removed.
+//An update that is killed, rather than failing, still leaves the archive without a directory.
+void restoreArchive() {
+	inputCarFile.close();
+	outputCarFile.close();
+	std::error_code error;
+	if (!archiveTail) {
+		fs::remove(carFileName, error);
+		return;
+	}
+	std::fstream archive{ carFileName, std::ios_base::in | std::ios_base::out | std::ios_base::binary };
+	archive.seekp(membersEnd);
+	archive.write(archiveTail->data(), archiveTail->size());
+	archive.close();
+	fs::resize_file(carFileName, membersEnd + archiveTail->size(), error);
+	if (!archive || error)
+		fprintf(stderr, "ERROR: Can't restore %s, it may be damaged\n", carFileName);
+}
+
+//Drops the members being replaced or deleted from the entries, once all of them are known. The members
+//written since the update began are those past membersEnd and stay.
+void endArchiveUpdate(std::unordered_set<std::string> const& superseded) {
+	supersedeMembers(superseded);
+	inputCarFile.close();
+}
+
+//Copies the live members into the temporary file, which replaces the archive on closing. Each member is
+//copied as is, by the kernel where it can, the rest through the streams. Only the extents of members kept
+//in solid blocks hold an offset, that of their block, which is patched once the member is copied. Blocks
+//come before the members that refer to them.
+void compactArchive() {
+	auto entries = readMemberEntries();
+	std::uint64_t dead = deadBytes(entries);
+	printf("%llu of %llu bytes are dead space (%d%%)\n", static_cast<unsigned long long>(dead),
+		static_cast<unsigned long long>(membersEnd), deadPercentage(dead));
+	if (dead == 0 || deadPercentage(dead) < static_cast<int>(compactThreshold)) {
+		printf("Below the %u%% threshold, the archive is left as it is\n", compactThreshold);
+		return;
+	}
+	openTemporaryFile();
+	FileRangeCopier copier{ carFileName, tempFileName };
+	std::unordered_map<std::uint64_t, std::uint64_t> movedBlocks;
+	std::uint64_t position{ 0 };
+	for (auto& entry : entries) {
+		setHeaderFileName(header, entry.name);
+		DirectoryEntry moved = entry;
+		moved.headerOffset = position;
+		moved.dataOffset = position + (entry.dataOffset - entry.headerOffset);
+		std::uint64_t length = entry.dataOffset + entry.compressedSize - entry.headerOffset;
+		std::uint64_t copied = copier.copy(entry.headerOffset, position, length);
+		if (copied < length) {
+			inputCarFile.clear();
+			inputCarFile.seekg(entry.headerOffset + copied);
+			outputCarFile.seekp(position + copied);
+			copyStream(inputCarFile, outputCarFile, length - copied, entry.name);
+			outputCarFile.flush();
+		}
+		if (isSolidBlock(entry.name))
+			movedBlocks[entry.headerOffset] = position;
+		if (isBlockReference(entry.compressionMethod)) {
+			auto extents = readExtents(inputCarFile, entry);
+			for (std::size_t i = 0; i < extents.size(); ++i) {
+				if (!movedBlocks.contains(extents[i].block))
+					fatalError("The solid block of " + entry.name + " is missing\n");
+				unsigned char offset[8];
+				packUnsignedData(8, movedBlocks[extents[i].block], offset);
+				outputCarFile.seekp(moved.dataOffset + i * extentRecordSize(entry.compressionMethod));
+				outputCarFile.write(reinterpret_cast<char*>(offset), 8);
+			}
+			outputCarFile.flush();
+		}
+		position += length;
+		outputDirectory.push_back(std::move(moved));
+	}
+	outputCarFile.seekp(position);
+}
+
+//A compacted archive is written to the temporary file, which replaces the old archive only once it is
+//complete. An archive updated in place gets its new directory first, and only then are the superseded
+//headers marked dead, so an update that fails before that can be undone by restoreArchive. The file is cut
+//after the new directory in case the old one reached further.
+void closeArchiveFiles(char command) {
+	inputDirectory.reset();
+	inputCarFile.close();
+	if (!outputCarFile.is_open())
+		return;
+	std::string outputName = (command == 'C') ? tempFileName : carFileName;
+	std::uint64_t dataEnd = outputCarFile.tellp();
+	writeArchiveDirectory(outputCarFile, outputDirectory);
+	std::uint64_t end = outputCarFile.tellp();
+	outputCarFile.flush();
+	if (!outputCarFile) //nothing is marked dead yet, an update can still be undone
+		throw stl::FileError("Error writing " + outputName + "\n");
+	for (auto& entry : deadMembers)
+		markMemberDead(entry);
+	outputCarFile.close();
+	if (!outputCarFile)
+		fatalError("Error writing " + outputName);
+	std::error_code error;
+	if (command == 'C') {
+		fs::rename(tempFileName, carFileName, error);
+		if (error)
+			fatalError("Can't rename " + std::string{ tempFileName } + " to " + std::string{ carFileName });
+		return;
+	}
+	fs::resize_file(carFileName, end, error);
+	if (error)
+		fatalError("Can't truncate " + std::string{ carFileName });
+	membersEnd = dataEnd;
+	std::uint64_t dead = deadBytes(outputDirectory);
+	if (deadPercentage(dead) >= static_cast<int>(compactThreshold))
+		printf("\n%d%% of the archive is dead space, -c reclaims it\n", deadPercentage(dead));
+}
+
+//* matches any run of characters and ? any single character
+bool matchesWildcard(const char* pattern, const char* name) {
+	if (*pattern == '\0')
+		return *name == '\0';
+	if (*pattern == '*')
+		return matchesWildcard(pattern + 1, name) || (*name != '\0' && matchesWildcard(pattern, name + 1));
+	if (*name == '\0' || (*pattern != '?' && *pattern != *name))
+		return false;
+	return matchesWildcard(pattern + 1, name + 1);
+}
+
+bool isWildcard(std::string const& name) {
+	return name.find_first_of("*?") != std::string::npos;
+}
+
+//Calls process for every member of the input archive named in the file list. Plain names are looked up in
+//the central directory when there is one, wildcards and archives without a directory need a pass over
+//the members. Returns the number of names not found, which are reported on stderr, so that they stay out
+//of the data -p and -b write.
+template <typename Process>
+int processSelectedMembers(int count, Process process) {
+	bool scan = !inputDirectory || std::any_of(std::begin(fileList), std::begin(fileList) + count, isWildcard);
+	if (!scan) {
+		int missing{ 0 };
+		for (int i = 0; i < count; ++i) {
+			if (auto entry = inputDirectory->find(fileList[i]); entry && !isSolidBlock(entry->name))
+				process(*entry);
+			else {
+				fprintf(stderr, "%s is not in the archive\n", fileList[i].c_str());
+				++missing;
+			}
+		}
+		return missing;
+	}
+	auto selected = [count](std::string const& name) {
+		return std::any_of(std::begin(fileList), std::begin(fileList) + count,
+			[&name](std::string const& pattern) { return matchesWildcard(pattern.c_str(), name.c_str()); });
+	};
+	std::vector<bool> found(count);
+	for (auto& entry : readMemberEntries()) {
+		if (!selected(entry.name) || isSolidBlock(entry.name))
+			continue;
+		process(entry);
+		for (int i = 0; i < count; ++i)
+			found[i] = found[i] || matchesWildcard(fileList[i].c_str(), entry.name.c_str());
+	}
+	int missing{ 0 };
+	for (int i = 0; i < count; ++i) {
+		if (!found[i] && !isWildcard(fileList[i])) {
+			fprintf(stderr, "%s is not in the archive\n", fileList[i].c_str());
+			++missing;
+		}
+	}
+	return missing;
+}
+
+//Expands count bytes of one coded stream, or of stored data, from the current position of the archive.
+//The functions expanding members take the archive to read, each thread expanding members has its own.
+//Model snapshots are made and loaded through the ppmc library only, there is no snapshot to expand a
+//member written with one by, so such a member is refused rather than expanded into garbage.
+void expandStream(std::iostream& archive, DirectoryEntry const& entry, int method, std::uint64_t count, OutputSink& output) {
+	if (entry.dictionaryID != 0)
+		throw stl::FileError(entry.name + " needs PPMC model snapshot " + std::to_string(entry.dictionaryID) + ", which quanta cannot load\n");
+	if (method == METHOD_STORED) {
+		copyStream(archive, output, count, entry.name);
+		return;
+	}
+	auto input = stl::attachBitFile(archive);
+	bool known{};
+	try {
+		known = expandWithMethod(method, input, output);
+	}
+	catch (stl::FileError const& error) { //the decoders report damage without knowing the member
+		throw stl::FileError(entry.name + ": " + error.what());
+	}
+	if (!known)
+		throw stl::FileError("Unknown compression method for " + entry.name + "\n");
+}
+
+//reads the header of the chunk at position, leaving the archive at the chunk's data
+void readChunkHeader(std::istream& archive, DirectoryEntry const& entry, std::uint64_t position, int& method, std::uint64_t& sourceLength, std::uint64_t& codedLength) {
+	unsigned char chunkHeader[CHUNK_HEADER_SIZE];
+	archive.clear();
+	archive.seekg(position);
+	archive.read(reinterpret_cast<char*>(chunkHeader), CHUNK_HEADER_SIZE);
+	if (archive.gcount() != CHUNK_HEADER_SIZE)
+		throw stl::FileError("Truncated data for file " + entry.name);
+	method = chunkHeader[0];
+	sourceLength = unpackUnsignedData(4, chunkHeader + 1);
+	codedLength = unpackUnsignedData(4, chunkHeader + 5);
+}
+
+//The chunks of solid blocks expanded last on this thread, the most recent at the back. The members of a
+//block are extracted one after another and the extents of deduplicated members keep returning to a few
+//blocks, so a block is expanded about once rather than once for every member or extent.
+struct ExpandedChunk {
+	std::uint64_t position{};
+	std::string data;
+};
+thread_local std::deque<ExpandedChunk> expandedChunks;
+
+std::string const& expandBlockChunk(std::iostream& archive, DirectoryEntry const& block, std::uint64_t position, int method, std::uint64_t codedLength) {
+	auto cached = std::find_if(std::begin(expandedChunks), std::end(expandedChunks),
+		[position](ExpandedChunk const& chunk) { return chunk.position == position; });
+	if (cached == std::end(expandedChunks)) {
+		std::string chunk;
+		StringSink output{ chunk };
+		expandStream(archive, block, method, codedLength, output);
+		output.flush();
+		if (expandedChunks.size() == EXPANDED_CHUNK_CACHE)
+			expandedChunks.pop_front();
+		expandedChunks.push_back({ position, std::move(chunk) });
+	}
+	else if (cached + 1 != std::end(expandedChunks)) {
+		ExpandedChunk chunk = std::move(*cached);
+		expandedChunks.erase(cached);
+		expandedChunks.push_back(std::move(chunk));
+	}
+	return expandedChunks.back().data;
+}
+
+//copies an extent out of the chunks of its block that overlap it, straight from the expanded chunks
+void expandExtent(std::iostream& archive, DirectoryEntry const& entry, Extent extent, OutputSink& output) {
+	Header blockHeader;
+	archive.clear();
+	archive.seekg(extent.block);
+	if (!readFileHeader(archive, blockHeader) || !isSolidBlock(blockHeader.filename))
+		throw stl::FileError("The solid block of " + entry.name + " is missing\n");
+	DirectoryEntry block{ blockHeader.filename };
+	block.dataOffset = archive.tellg();
+	std::uint64_t end = block.dataOffset + blockHeader.compressedSize, blockPosition{ 0 };
+	for (std::uint64_t position = block.dataOffset; position < end && extent.length != 0; ) {
+		int method{};
+		std::uint64_t sourceLength{}, codedLength{};
+		readChunkHeader(archive, block, position, method, sourceLength, codedLength);
+		if (blockPosition + sourceLength > extent.offset) {
+			std::string const& data = expandBlockChunk(archive, block, position, method, codedLength);
+			std::uint64_t start = extent.offset - blockPosition;
+			std::uint64_t length = std::min(extent.length, data.size() - std::min<std::uint64_t>(start, data.size()));
+			if (length == 0)
 				break;
+			output.write(data.data() + start, length);
+			extent.offset += length;
+			extent.length -= length;
+		}
+		blockPosition += sourceLength;
+		position += CHUNK_HEADER_SIZE + codedLength;
+	}
+}
+
+//Expands a member into output. The chunks of a member are found from their headers, a coder may read past
+//the end of its own chunk. A chunk of source size 0 ends them, the frame table follows it.
+void expandMemberData(std::iostream& archive, DirectoryEntry const& entry, OutputSink& output) {
+	archive.clear();
+	archive.seekg(entry.dataOffset);
+	if (isBlockReference(entry.compressionMethod)) {
+		for (auto& extent : readExtents(archive, entry))
+			expandExtent(archive, entry, extent, output);
+		return;
+	}
+	std::uint64_t end = entry.dataOffset + entry.compressedSize;
+	for (std::uint64_t position = entry.dataOffset; position < end; ) {
+		int method{};
+		std::uint64_t sourceLength{}, codedLength{};
+		readChunkHeader(archive, entry, position, method, sourceLength, codedLength);
+		if (sourceLength == 0)
+			break;
+		expandStream(archive, entry, method, codedLength, output);
+		position += CHUNK_HEADER_SIZE + codedLength;
+	}
+}
+
+//Indexes the chunks of the deduplicated members already in the archive, so the files added now can refer
+//to them as well. An extent is a run of chunks cut one after another from one file, and a chunk is cut
+//by its bytes alone, so cutting the bytes of the extent again finds the same chunks as long as the chunk
+//size is the one they were added with. The blocks are numbered ahead of those this run writes.
+void indexArchivedChunks(Deduplicator& dedup) {
+	std::unordered_map<std::uint64_t, std::uint64_t> blockNumbers; //by header offset
+	for (auto& entry : outputDirectory) {
+		if (entry.compressionMethod != DEDUP_MEMBER_METHOD || entry.headerOffset >= membersEnd)
+			continue;
+		for (auto& extent : readExtents(inputCarFile, entry)) {
+			auto [number, added] = blockNumbers.try_emplace(extent.block, dedup.blockOffsets.size());
+			if (added)
+				dedup.blockOffsets.push_back(extent.block);
+			std::string data;
+			StringSink output{ data };
+			expandExtent(inputCarFile, entry, extent, output);
+			if (!output.flush() || data.size() != extent.length)
+				throw stl::FileError("Truncated data for file " + entry.name);
+			auto bytes = reinterpret_cast<const unsigned char*>(data.data());
+			for (std::size_t position{ 0 }; position < data.size(); ) {
+				std::size_t length = dedup.chunker.cut(bytes + position, data.size() - position);
+				dedup.chunks.try_emplace(fingerprintChunk(bytes + position, length), Extent{ number->second, extent.offset + position, length });
+				position += length;
+			}
+		}
+	}
+}
+
+//Splits each file into content defined chunks and stores every chunk whose fingerprint is not in the
+//archive and has not been seen in this run once, in solid blocks of the unique chunks. A file becomes a
+//member listing the extents of the blocks its chunks are in, so identical files and the unchanged parts
+//of similar ones take no space beyond their extent lists.
+void addFilesDeduplicated(FileSource const& next) {
+	Deduplicator dedup;
+	indexArchivedChunks(dedup);
+	auto start = std::chrono::steady_clock::now();
+	std::vector<unsigned char> buffer(std::max<std::size_t>(dedup.chunker.maximumSize() * 2, 1 << 20));
+	std::size_t files{ 0 };
+	for (WalkedFile file; next(file); ++files) {
+		std::ifstream inputFile{ file.path, std::ios_base::binary };
+		if (!inputFile.is_open())
+			throw stl::FileError("quanta could not open " + file.path + "\n");
+		DedupMember member{ file.name };
+		member.modified = modifiedTime(file.path);
+		std::uint32_t crc{ CRC_MASK };
+		ContentHasher hasher;
+		std::size_t available{ 0 };
+		std::uint64_t uniqueBefore = dedup.uniqueBytes;
+		for (bool end = false; !end || available != 0; ) {
+			if (!end) {
+				inputFile.read(reinterpret_cast<char*>(buffer.data() + available), buffer.size() - available);
+				available += static_cast<std::size_t>(inputFile.gcount());
+				end = !inputFile;
+			}
+			std::size_t position{ 0 };
+			while (available - position >= dedup.chunker.maximumSize() || (end && position < available)) {
+				std::size_t length = dedup.chunker.cut(buffer.data() + position, available - position);
+				crc = calculateBlockCRC32(length, crc, buffer.data() + position);
+				hasher.update(buffer.data() + position, length);
+				deduplicateChunk(dedup, member, buffer.data() + position, length);
+				position += length;
 			}
+			std::memmove(buffer.data(), buffer.data() + position, available - position);
+			available -= position;
 		}
-		fileList[i] = s;
-		if (!skip) {
-			std::copy(std::begin(fileList[i]), std::end(fileList[i]), header.filename);
-			insert(inputFile, "Adding");
+		member.crc = crc ^ CRC_MASK;
+		member.contentHash = hasher.finish().low;
+		for (auto& extent : member.extents)
+			member.size += extent.length;
+		printf("Adding %s to archive, %llu of %llu bytes new\n", member.name.c_str(),
+			static_cast<unsigned long long>(dedup.uniqueBytes - uniqueBefore), static_cast<unsigned long long>(member.size));
+		dedup.pending.push_back(std::move(member));
+	}
+	flushDedupBlock(dedup);
+	if (files == 0)
+		return;
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	printf("\nDeduplicated %llu chunks: %llu of %llu bytes unique, ratio %.2f, %.1f MB/s\n",
+		static_cast<unsigned long long>(dedup.totalChunks), static_cast<unsigned long long>(dedup.uniqueBytes),
+		static_cast<unsigned long long>(dedup.totalBytes), dedup.uniqueBytes == 0 ? 1.0 : static_cast<double>(dedup.totalBytes) / dedup.uniqueBytes,
+		seconds > 0 ? dedup.totalBytes / seconds / (1 << 20) : 0.0);
+}
+
+//expands a member into output and checks its CRC, returns false on a mismatch
+bool expandMember(std::iostream& archive, DirectoryEntry const& entry, std::ostream& output) {
+	CRCSink checked{ output.rdbuf() };
+	expandMemberData(archive, entry, checked);
+	checked.flush();
+	return checked.crc() == entry.originalCRC && checked.size() == entry.originalSize;
+}
+
+//A chunk of a member, where it starts in the member's source and where its header is
+struct Frame {
+	std::uint64_t sourceOffset{};
+	std::uint64_t position{};
+	std::uint32_t crc{};
+};
+
+//the chunks of a member with a frame table, nothing when the member has none
+std::vector<Frame> readFrameTable(std::istream& archive, DirectoryEntry const& entry) {
+	std::vector<Frame> frames;
+	unsigned char trailer[8], chunkHeader[CHUNK_HEADER_SIZE];
+	if (isBlockReference(entry.compressionMethod) || entry.compressedSize < CHUNK_HEADER_SIZE + sizeof trailer)
+		return frames;
+	std::uint64_t end = entry.dataOffset + entry.compressedSize;
+	archive.clear();
+	archive.seekg(end - sizeof trailer);
+	if (!archive.read(reinterpret_cast<char*>(trailer), sizeof trailer) || std::memcmp(trailer + 4, FRAME_TABLE_MAGIC, 4) != 0)
+		return frames;
+	std::uint64_t tableSize = unpackUnsignedData(4, trailer) * FRAME_RECORD_SIZE + sizeof trailer;
+	if (tableSize + CHUNK_HEADER_SIZE > entry.compressedSize)
+		return frames;
+	archive.seekg(end - tableSize - CHUNK_HEADER_SIZE);
+	archive.read(reinterpret_cast<char*>(chunkHeader), CHUNK_HEADER_SIZE);
+	if (!archive || chunkHeader[0] != FRAME_TABLE_CHUNK || unpackUnsignedData(4, chunkHeader + 1) != 0 || unpackUnsignedData(4, chunkHeader + 5) != tableSize)
+		return frames;
+	std::vector<unsigned char> records(tableSize - sizeof trailer);
+	if (!archive.read(reinterpret_cast<char*>(records.data()), records.size()))
+		throw stl::FileError("Truncated frame table for file " + entry.name);
+	for (std::size_t i = 0; i < records.size(); i += FRAME_RECORD_SIZE) {
+		frames.push_back({ unpackUnsignedData(8, records.data() + i), entry.dataOffset + unpackUnsignedData(8, records.data() + i + 8),
+			static_cast<std::uint32_t>(unpackUnsignedData(4, records.data() + i + 16)) });
+	}
+	return frames;
+}
+
+//Expands the bytes offset to offset + length of a member into output, fewer when the member ends first.
+//Only the chunks overlapping the range are expanded: they are looked up in the frame table of a framed
+//member and checked against the CRCs in it, and found from the chunk headers of any other member. Members
+//kept in solid blocks are expanded from the start, and checked whole.
+void expandMemberRange(std::iostream& archive, DirectoryEntry const& entry, std::uint64_t offset, std::uint64_t length, OutputSink& output) {
+	if (offset >= entry.originalSize)
+		return;
+	length = std::min(length, entry.originalSize - offset);
+	if (isBlockReference(entry.compressionMethod)) {
+		RangeSink range{ output, 0, offset, length };
+		expandMemberData(archive, entry, range);
+		range.flush();
+		if (range.crc() != entry.originalCRC || range.size() != entry.originalSize)
+			throw stl::FileError("CRC error reading " + entry.name);
+		return;
+	}
+	auto frames = readFrameTable(archive, entry);
+	std::uint64_t position = entry.dataOffset, sourceOffset{ 0 };
+	std::size_t frame{ 0 }; //the entry in frames of the chunk at position
+	if (!frames.empty()) {
+		auto first = std::upper_bound(std::begin(frames), std::end(frames), offset,
+			[](std::uint64_t offset, Frame const& frame) { return offset < frame.sourceOffset; });
+		frame = std::max<std::ptrdiff_t>(first - std::begin(frames) - 1, 0);
+		position = frames[frame].position;
+		sourceOffset = frames[frame].sourceOffset;
+	}
+	for (std::uint64_t end = entry.dataOffset + entry.compressedSize; position < end && sourceOffset < offset + length; ++frame) {
+		int method{};
+		std::uint64_t sourceLength{}, codedLength{};
+		readChunkHeader(archive, entry, position, method, sourceLength, codedLength);
+		if (sourceLength == 0)
+			break;
+		bool tabled = frame < frames.size();
+		if (tabled && (frames[frame].position != position || frames[frame].sourceOffset != sourceOffset))
+			throw stl::FileError("Damaged frame table for file " + entry.name);
+		if (sourceOffset + sourceLength > offset) {
+			RangeSink range{ output, sourceOffset, offset, length };
+			expandStream(archive, entry, method, codedLength, range);
+			range.flush();
+			if (range.size() != sourceLength || (tabled && range.crc() != frames[frame].crc))
+				throw stl::FileError("CRC error reading " + entry.name);
+		}
+		sourceOffset += sourceLength;
+		position += CHUNK_HEADER_SIZE + codedLength;
+	}
+}
+
+//Library call: the bytes offset to offset + length of the member entry, fewer when the member ends first.
+//Damage is reported as stl::FileError.
+std::string readMemberRange(std::iostream& archive, DirectoryEntry const& entry, std::uint64_t offset, std::uint64_t length) {
+	std::string bytes;
+	StringSink output{ bytes };
+	expandMemberRange(archive, entry, offset, length, output);
+	output.flush();
+	return bytes;
+}
+
+//A piece of a member that a worker expands on its own: one chunk of a member, or all of a member kept in
+//solid blocks. Its CRC is combined with those of the member's other pieces in order once all are done.
+struct ExpansionTask {
+	std::size_t member{};
+	std::uint64_t chunkPosition{ UINT64_MAX }; //UINT64_MAX for the whole member
+	int method{};
+	std::uint64_t codedLength{};
+	std::uint64_t outputOffset{};
+	std::uint32_t crc{};
+	std::uint64_t size{};
+	std::string error{};
+	SearchPiece found{}; //for -g
+};
+
+struct MemberExpansion {
+	DirectoryEntry entry;
+	std::unique_ptr<PositionalFile> output; //opened by the worker taking the first piece, nullptr for -t
+	std::size_t firstTask{};
+	std::size_t taskCount{};
+	std::size_t tasksDone{};
+};
+
+//splits each member into ExpansionTasks, reading the chunk headers of those not kept in solid blocks
+std::vector<ExpansionTask> planExpansion(std::vector<MemberExpansion>& members) {
+	std::vector<ExpansionTask> tasks;
+	for (std::size_t i = 0; i < members.size(); ++i) {
+		auto& entry = members[i].entry;
+		members[i].firstTask = tasks.size();
+		std::uint64_t end = entry.dataOffset + entry.compressedSize, outputOffset{ 0 };
+		bool chunked = !isBlockReference(entry.compressionMethod);
+		for (std::uint64_t position = entry.dataOffset; chunked && position < end; ) {
+			ExpansionTask task{ i, position };
+			std::uint64_t sourceLength{};
+			readChunkHeader(inputCarFile, entry, position, task.method, sourceLength, task.codedLength);
+			if (sourceLength == 0)
+				break;
+			task.outputOffset = outputOffset;
+			tasks.push_back(std::move(task));
+			outputOffset += sourceLength;
+			position += CHUNK_HEADER_SIZE + task.codedLength;
+		}
+		if (tasks.size() == members[i].firstTask)
+			tasks.push_back({ i });
+		members[i].taskCount = tasks.size() - members[i].firstTask;
+	}
+	return tasks;
+}
+
+//expands a task and, when pattern is given, matches the lines of what it expands
+void runExpansionTask(std::iostream& archive, MemberExpansion& member, ExpansionTask& task, LinePattern const* pattern) {
+	std::unique_ptr<PositionalOutputBuffer> positioned;
+	if (member.output)
+		positioned = std::make_unique<PositionalOutputBuffer>(*member.output, task.outputOffset);
+	std::unique_ptr<CRCSink> checked; //for -t the CRC is taken as the data is decoded and nothing is kept
+	if (pattern)
+		checked = std::make_unique<LineSearchSink>(*pattern, member.entry.name, task.outputOffset, task.outputOffset == 0, task.found);
+	else
+		checked = std::make_unique<CRCSink>(positioned.get());
+	if (task.chunkPosition == UINT64_MAX)
+		expandMemberData(archive, member.entry, *checked);
+	else {
+		archive.clear();
+		archive.seekg(task.chunkPosition + CHUNK_HEADER_SIZE);
+		expandStream(archive, member.entry, task.method, task.codedLength, *checked);
+	}
+	if (!checked->flush() || (positioned && positioned->pubsync() != 0))
+		throw stl::FileError("Error writing " + member.entry.name);
+	if (pattern)
+		static_cast<LineSearchSink&>(*checked).finish(false);
+	task.crc = checked->crc();
+	task.size = checked->size();
+}
+
+//Matches the lines split between the pieces of a member, which their tasks left in their heads and tails,
+//and returns the matching lines of the whole member in order.
+SearchPiece joinSearchPieces(LinePattern const& pattern, std::string const& name, std::span<ExpansionTask> tasks) {
+	SearchPiece joined, seamFound;
+	std::unique_ptr<LineSearchSink> seam; //the line from the tail of one piece to the head of a later one
+	for (auto& task : tasks) {
+		if (seam) {
+			seam->write(task.found.head.data(), task.found.head.size());
+			if (task.found.headEnded) {
+				seam->finish(true);
+				seam.reset();
+			}
+		}
+		joined.matches += std::move(seamFound.matches);
+		joined.matchCount += seamFound.matchCount + task.found.matchCount;
+		seamFound = {};
+		joined.matches += task.found.matches;
+		if (!seam) {
+			seam = std::make_unique<LineSearchSink>(pattern, name, task.found.tailOffset, true, seamFound);
+			seam->write(task.found.tail.data(), task.found.tail.size());
+		}
+	}
+	if (seam)
+		seam->finish(true);
+	joined.matches += seamFound.matches;
+	joined.matchCount += seamFound.matchCount;
+	return joined;
+}
+
+//false for a member name that is absolute or leads out of the directory extracted to with ..
+bool isRelativeMemberName(std::string const& name) {
+	fs::path path{ name };
+	if (name.empty() || path.has_root_path())
+		return false;
+	return std::none_of(std::begin(path), std::end(path), [](fs::path const& part) { return part == ".."; });
+}
+
+//opens the file a member is extracted to, creating the directories in its name
+std::unique_ptr<PositionalFile> createMemberFile(std::string const& name) {
+	std::error_code error;
+	fs::path parent = fs::path(name).parent_path();
+	if (!parent.empty())
+		fs::create_directories(parent, error);
+	return std::make_unique<PositionalFile>(name);
+}
+
+//Extracts the members, or only tests them when test is set, on workerCount threads. With a pattern, the
+//members are tested and the lines matching it printed instead of the names. Each worker reads
+//the archive through its own stream and takes the pieces in archive order, chunks of large members
+//included, and writes what it expands with positional writes, so pieces of one file can finish in any
+//order. The calling thread reports each member once all its pieces are done, in archive order, so the
+//output does not depend on the number of workers. Workers stay within MAX_PENDING_MEMBERS members of
+//the one being reported, which bounds the files open at once. Returns the number of members that failed.
+std::size_t expandMembersInParallel(std::vector<DirectoryEntry> entries, bool test, LinePattern const* pattern = nullptr) {
+	std::vector<MemberExpansion> members(entries.size());
+	for (std::size_t i = 0; i < entries.size(); ++i)
+		members[i].entry = std::move(entries[i]);
+	auto tasks = planExpansion(members);
+	std::mutex mutex;
+	std::condition_variable changed;
+	std::size_t nextTask{ 0 }, nextToReport{ 0 };
+	auto worker = [&] {
+		std::fstream archive{ carFileName, std::ios_base::in | std::ios_base::binary };
+		std::unique_lock lock{ mutex };
+		for (;;) {
+			changed.wait(lock, [&] {
+				return nextTask == tasks.size() || tasks[nextTask].member < nextToReport + MAX_PENDING_MEMBERS;
+			});
+			if (nextTask == tasks.size())
+				return;
+			ExpansionTask& task = tasks[nextTask++];
+			MemberExpansion& member = members[task.member];
+			if (!test && !member.output && !isRelativeMemberName(member.entry.name))
+				task.error = "Not extracting " + member.entry.name + ", it would be written outside the current directory";
+			else if (!test && !member.output) {
+				member.output = createMemberFile(member.entry.name);
+				if (!member.output->isOpen())
+					task.error = "Can't open " + member.entry.name + " for output";
+			}
+			lock.unlock();
+			try {
+				if (task.error.empty() && !archive.is_open())
+					task.error = "Can't open archive: " + std::string{ carFileName };
+				else if (task.error.empty())
+					runExpansionTask(archive, member, task, pattern);
+			}
+			catch (stl::FileError const& error) {
+				task.error = error.what();
+			}
+			lock.lock();
+			++member.tasksDone;
+			changed.notify_all();
+		}
+	};
+	std::vector<std::jthread> workers;
+	for (unsigned i = 0; i < std::min<std::size_t>(workerCount, tasks.size()); ++i)
+		workers.emplace_back(worker);
+	std::size_t failures{ 0 }, matchCount{ 0 };
+	for (auto& member : members) {
+		{
+			std::unique_lock lock{ mutex };
+			changed.wait(lock, [&] { return member.tasksDone == member.taskCount; });
+		}
+		if (pattern) {
+			auto found = joinSearchPieces(*pattern, member.entry.name, std::span{ tasks }.subspan(member.firstTask, member.taskCount));
+			fwrite(found.matches.data(), 1, found.matches.size(), stdout);
+			matchCount += found.matchCount;
 		}
 		else
-			inputFile.close();
+			printf("%s %s\n", test ? "Testing" : "Extracting", member.entry.name.c_str());
+		std::uint32_t crc{ 0 };
+		std::uint64_t size{ 0 };
+		std::string error;
+		for (std::size_t i = member.firstTask; i < member.firstTask + member.taskCount; ++i) {
+			if (error.empty())
+				error = tasks[i].error;
+			crc = combineCRC32(crc, tasks[i].crc, tasks[i].size);
+			size += tasks[i].size;
+		}
+		if (member.output)
+			member.output->close();
+		if (error.empty() && (crc != member.entry.originalCRC || size != member.entry.originalSize))
+			error = std::string{ "CRC error " } + (pattern ? "searching " : test ? "testing " : "extracting ") + member.entry.name;
+		if (!error.empty()) {
+			printf("%s\n", error.c_str());
+			++failures;
+			if (member.output)
+				fs::remove(member.entry.name);
+		}
+		std::lock_guard lock{ mutex };
+		member.output.reset();
+		++nextToReport;
+		changed.notify_all();
 	}
+	if (pattern)
+		printf("\n%zu matching lines in %zu members searched, %zu failed\n", matchCount, members.size(), failures);
+	else if (test)
+		printf("\n%zu members tested, %zu failed\n", members.size(), failures);
+	return failures;
+}
+
+//-b: the bytes of the range the command gave, on standard output
+void writeMemberRange(DirectoryEntry const& entry) {
+	CRCSink output{ std::cout.rdbuf() };
+	expandMemberRange(inputCarFile, entry, rangeOffset, rangeLength, output);
+	if (!output.flush() || !std::cout.flush())
+		throw stl::FileError("Error writing the bytes of " + entry.name);
 }
 
+void printMember(DirectoryEntry const& entry) {
+	std::cout << entry.name << "\n";
+	if (!expandMember(inputCarFile, entry, std::cout))
+		fprintf(stderr, "\nCRC error printing %s\n", entry.name.c_str());
+}
+
+void listMember(DirectoryEntry const& entry) {
+	int ratio = (entry.originalSize == 0) ? 0 : static_cast<int>(100 - 100.0 * entry.compressedSize / entry.originalSize);
+	char crc[9];
+	snprintf(crc, sizeof crc, "%08x", entry.originalCRC);
+	std::cout << std::left << std::setw(40) << entry.name << std::left << std::setw(15) << entry.originalSize
+		<< std::left << std::setw(15) << entry.compressedSize << std::left << std::setw(10) << (std::to_string(ratio) + "%")
+		<< std::left << std::setw(10) << crc;
+	if (entry.compressionMethod == SOLID_MEMBER_METHOD)
+		std::cout << "solid\n";
+	else if (entry.compressionMethod == DEDUP_MEMBER_METHOD)
+		std::cout << "dedup\n";
+	else
+		std::cout << static_cast<int>(entry.compressionMethod) << "\n";
+}
 
 void printListTitles() {
 	std::cout << std::left << std::setw(40) << "Filename" << std::left << std::setw(15) << "Original"
 		<< std::left << std::setw(15) << "compressed" << std::left << std::setw(10) << "ratio"
-		<< std::left << std::setw(10) << "CRC-32" << std::left << std::setw(10) << "Method\n";
+		<< std::left << std::setw(10) << "CRC-32" << "Method\n";
 }
 
 
 
+//standard input and output carry binary data
+void setBinaryStandardStreams() {
+#if defined (_WIN32)
+	_setmode(_fileno(stdin), _O_BINARY);
+	_setmode(_fileno(stdout), _O_BINARY);
+#endif
+}
+
+//-z: STREAM_MAGIC, the chunks of a member and an empty chunk header, followed by the size and CRC
+//of the input. The method is picked from the first chunk. Nothing is ever sought and no more than one chunk
+//is held, so the input can come from a pipe and the output go to one.
+void compressStandardStream(std::istream& input, std::ostream& output) {
+	CRCInputBuffer source{ *input.rdbuf() };
+	int method{ -1 };
+	output.write(STREAM_MAGIC, 4);
+	writeChunks(source, output, MEMBER_CHUNK_SIZE, [&method](const char* chunk, std::size_t length, std::uint64_t) {
+		if (method < 0)
+			method = selectMethod(std::string_view{ chunk, length }, selectionEffort).method;
+		return method;
+	});
+	unsigned char trailer[CHUNK_HEADER_SIZE + 12]{};
+	packUnsignedData(8, source.size(), trailer + CHUNK_HEADER_SIZE);
+	packUnsignedData(4, source.crc(), trailer + CHUNK_HEADER_SIZE + 8);
+	output.write(reinterpret_cast<char*>(trailer), sizeof trailer);
+	output.flush();
+	if (!output)
+		fatalError("Error writing the compressed stream\n");
+}
+
+//-u: the reverse of -z. Each chunk is read whole before it is expanded, a coder may read past its end
+//and a pipe cannot be rewound.
+void expandStandardStream(std::istream& input, std::ostream& output) {
+	char magic[4];
+	if (!input.read(magic, 4) || std::memcmp(magic, STREAM_MAGIC, 4) != 0)
+		fatalError("The input is not a quanta stream\n");
+	CRCSink checked{ output.rdbuf() };
+	std::vector<char> coded;
+	for (;;) {
+		unsigned char chunkHeader[CHUNK_HEADER_SIZE];
+		if (!input.read(reinterpret_cast<char*>(chunkHeader), CHUNK_HEADER_SIZE))
+			fatalError("Truncated stream\n");
+		std::uint64_t sourceLength = unpackUnsignedData(4, chunkHeader + 1);
+		std::uint64_t codedLength = unpackUnsignedData(4, chunkHeader + 5);
+		if (sourceLength == 0)
+			break;
+		coded.resize(codedLength);
+		if (!input.read(coded.data(), codedLength))
+			fatalError("Truncated stream\n");
+		if (chunkHeader[0] == METHOD_STORED) {
+			checked.write(coded.data(), codedLength);
+			continue;
+		}
+		MemoryBuffer memory{ coded.data(), coded.size() };
+		std::iostream codedInput{ &memory };
+		auto bitFile = stl::attachBitFile(codedInput);
+		if (!expandWithMethod(chunkHeader[0], bitFile, checked))
+			fatalError("Unknown compression method in the stream\n");
+	}
+	unsigned char trailer[12];
+	if (!input.read(reinterpret_cast<char*>(trailer), sizeof trailer))
+		fatalError("Truncated stream\n");
+	if (!checked.flush())
+		fatalError("Error writing the expanded stream\n");
+	if (checked.size() != unpackUnsignedData(8, trailer) || checked.crc() != unpackUnsignedData(4, trailer + 8))
+		fatalError("CRC error in the stream\n");
+}
+
+//Adds the files listed for -a and -r to the archive being updated, returns the number of those listed
+//for -r that are not in it.
+std::size_t addFiles(char command) {
+	AddSelection selection{ command == 'R' };
+	FileWalker walker{ fileList, workerCount > 1 ? workerCount : 0 };
+	FileSource next = [&walker, &selection](WalkedFile& file) {
+		while (walker.next(file)) {
+			if (selection.take(file))
+				return true;
+		}
+		return false;
+	};
+	std::vector<WalkedFile> files;
+	if (solidBlockSize != 0 && dedupChunkSize == 0) { //the files are grouped by kind, which takes all of them
+		for (WalkedFile file; next(file); )
+			files.push_back(std::move(file));
+		addFilesInSolidBlocks(takeSolidFiles(files));
+		next = listedFiles(files);
+	}
+	if (dedupChunkSize != 0)
+		addFilesDeduplicated(next);
+	else if (workerCount > 1)
+		addFileListToArchiveInParallel(next);
+	else
+		addFileListToArchive(next);
+	if (selection.unchanged != 0)
+		printf("\n%zu files are unchanged, their members are kept as they are\n", selection.unchanged);
+	endArchiveUpdate(selection.replaced);
+	closeArchiveFiles(command);
+	return selection.missing;
+}
+
+//Runs the command on the archive opened and the file list built and returns the exit status. The archive
+//read paths report damage as stl::FileError, as do the updates, which restore the archive first.
+int runCommand(char command, int count) {
+	if (command == 'A' || command == 'R') {
+		beginArchiveUpdate();
+		try {
+			return addFiles(command) == 0 ? 0 : 1;
+		}
+		catch (...) {
+			restoreArchive();
+			throw;
+		}
+	}
+	else if (command == 'D') {
+		std::unordered_set<std::string> names;
+		processSelectedMembers(count, [&names](DirectoryEntry const& entry) {
+			printf("Deleting %s\n", entry.name.c_str());
+			names.insert(entry.name);
+		});
+		beginArchiveUpdate();
+		try {
+			endArchiveUpdate(names);
+			closeArchiveFiles(command);
+		}
+		catch (...) {
+			restoreArchive();
+			throw;
+		}
+	}
+	else if (command == 'C') {
+		compactArchive();
+		closeArchiveFiles(command);
+	}
+	else if (command == 'L') {
+		printListTitles();
+		processSelectedMembers(count, listMember);
+	}
+	else if (command == 'X' || command == 'T') {
+		std::vector<DirectoryEntry> entries;
+		int missing = processSelectedMembers(count, [&entries](DirectoryEntry const& entry) { entries.push_back(entry); });
+		std::size_t failures = expandMembersInParallel(std::move(entries), command == 'T');
+		return missing == 0 && failures == 0 ? 0 : 1;
+	}
+	else if (command == 'G') {
+		LinePattern pattern{ searchPattern };
+		std::vector<DirectoryEntry> entries;
+		int missing = processSelectedMembers(count, [&entries](DirectoryEntry const& entry) { entries.push_back(entry); });
+		std::size_t failures = expandMembersInParallel(std::move(entries), true, &pattern);
+		return missing == 0 && failures == 0 ? 0 : 1;
+	}
+	else if (command == 'P')
+		return processSelectedMembers(count, printMember) == 0 ? 0 : 1;
+	else if (command == 'B')
+		return processSelectedMembers(count, writeMemberRange) == 0 ? 0 : 1;
+	return 0;
+}
+
 int main(int argc, char* argv[]) {
 	testCRCTable();
 	char command{};
 	int count{};
 	//std::cout << "******************************* QUANTA 1.0 *******************************\n";
+	if (argc > 2)
+		argc = parseOptions(argc, argv);
 	command = parseArguments(argc, argv);
-	printf("\n");
+	if (command == 'Z' || command == 'U') {
+		setBinaryStandardStreams();
+		try {
+			if (command == 'Z')
+				compressStandardStream(std::cin, std::cout);
+			else
+				expandStandardStream(std::cin, std::cout);
+		}
+		catch (stl::FileError const& error) {
+			fatalError(error.what());
+		}
+		return 0;
+	}
+	if (command == 'G') { //the pattern comes before the archive name
+		searchPattern = argv[2];
+		std::copy(argv + 3, argv + argc, argv + 2);
+		--argc;
+	}
+	if (command == 'B') { //the range follows the file name
+		rangeOffset = parseByteCount(argv[4]);
+		rangeLength = parseByteCount(argv[5]);
+		argc = 4;
+		setBinaryStandardStreams();
+	}
+	else
+		printf("\n");
 	openArchiveFiles(argv[2], command);
 	count = buildFileList(argc - 3, argv + 3, command);
-	/*for (auto i{ 0 }; i < count; ++i) {
-		std::cout << fileList[i] << "\n";
-	}*/
-	if (command == 'A')
-		addFileListToArchive(count);
-	else
-		count = 0;
-	if (command == 'L')
-		printListTitles();
-	return 0;
+	try {
+		return runCommand(command, count);
+	}
+	catch (stl::FileError const& error) {
+		fatalError(error.what());
+	}
+	return 1;
 }
\ No newline at end of file